@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <vector>
+
+#include "math.hpp"
+#include "reference_orbit.hpp"
+#include "render_config.hpp"
+#include "thread_pool.hpp"
+
+// bivariate linear approximation of l perturbation steps starting at some
+// reference iteration m: dz(m+l) = A * dz(m) + B * dc, valid while |dz| < r.
+// D is the delta type, double or FloatExp
+template <typename D>
+struct BLAStep {
+    D ax, ay;
+    D bx, by;
+    D r, r2;
+    int l;
+};
+
+inline double _bla_abs(double x, double y) { return std::hypot(x, y); }
+inline FloatExp _bla_abs(const FloatExp& x, const FloatExp& y) {
+    return sqrt(x * x + y * y);
+}
+
+// hierarchical table of BLA steps along a reference orbit. level 0 holds the
+// single steps starting at m = 1, 2, ..., level k merges pairs of level k - 1
+// so entry i covers the iterations [1 + i * 2^k, 1 + (i + 1) * 2^k)
+template <typename D>
+struct BLATable {
+    std::vector<std::vector<BLAStep<D>>> levels;
+
+    // a step x followed by a step y
+    static BLAStep<D> merge(const BLAStep<D>& x, const BLAStep<D>& y,
+                            const D& c_max) {
+        BLAStep<D> s;
+        // A = Ay * Ax
+        s.ax = y.ax * x.ax - y.ay * x.ay;
+        s.ay = y.ax * x.ay + y.ay * x.ax;
+        // B = Ay * Bx + By
+        s.bx = y.ax * x.bx - y.ay * x.by + y.bx;
+        s.by = y.ax * x.by + y.ay * x.bx + y.by;
+
+        D a_x = _bla_abs(x.ax, x.ay);
+        D b_x = _bla_abs(x.bx, x.by);
+        s.r = std::max(D(0.0), std::min(x.r, (y.r - b_x * c_max) / a_x));
+        s.r2 = s.r * s.r;
+        s.l = x.l + y.l;
+        return s;
+    }
+
+    // builds all levels for orbit. c_max is the largest |dc| of any pixel
+    // that will use the table. every level is built in parallel, the levels
+    // themselves depend on each other. a build that progress cancels leaves
+    // the table empty
+    void build(const ReferenceOrbit& orbit, const D& c_max,
+               ThreadPool& threads, const RenderProgress* progress = nullptr) {
+        levels.clear();
+
+        // single steps m -> m + 1 need Z(m + 1) to exist
+        int count = orbit.length - 2;
+        if (count <= 0) return;
+
+        auto cancelled = [progress] {
+            return progress && progress->is_cancelled();
+        };
+        auto run = [&threads, &cancelled](int n, auto fn) {
+            if (n <= BLA_BUILD_CHUNK) {
+                fn(0, n);
+            } else {
+                threads.parallel_chunks(n, BLA_BUILD_CHUNK,
+                                        [&](int begin, int end) {
+                                            if (!cancelled()) fn(begin, end);
+                                        });
+            }
+        };
+
+        levels.emplace_back(count);
+        run(count, [&](int begin, int end) {
+            std::vector<BLAStep<D>>& level = levels[0];
+            for (int i = begin; i < end; i++) {
+                int m = i + 1;
+                double zx = orbit.zx[m], zy = orbit.zy[m];
+
+                // dz(m+1) = 2 * Z(m) * dz(m) + dc, dropping dz(m)^2
+                level[i] = {2.0 * zx, 2.0 * zy, 1.0, 0.0, 0.0, 0.0, 1};
+                level[i].r = D(BLA_EPSILON * std::hypot(zx, zy));
+                level[i].r2 = level[i].r * level[i].r;
+            }
+        });
+
+        while (levels.back().size() > 1) {
+            if (cancelled()) {
+                levels.clear();
+                return;
+            }
+
+            int prev_count = levels.back().size();
+            int next_count = (prev_count + 1) / 2;
+
+            levels.emplace_back(next_count);
+            std::vector<BLAStep<D>>& prev = levels[levels.size() - 2];
+            std::vector<BLAStep<D>>& next = levels.back();
+
+            run(next_count, [&](int begin, int end) {
+                for (int i = begin; i < end; i++) {
+                    if (2 * i + 1 < prev_count) {
+                        next[i] = merge(prev[2 * i], prev[2 * i + 1], c_max);
+                    } else {
+                        next[i] = prev[2 * i];
+                    }
+                }
+            });
+        }
+        if (cancelled()) levels.clear();
+    }
+
+    // longest step starting at iteration m that is valid for |dz|^2 = z2 and
+    // skips at most max_skip iterations, nullptr if there is none
+    const BLAStep<D>* lookup(int m, const D& z2, int max_skip) const {
+        if (m < 1 || levels.empty()) return nullptr;
+
+        // every merged step is at most as valid as the single step it
+        // starts with, so most misses stop here
+        int j = m - 1;
+        if (j >= (int)levels[0].size() || !(z2 < levels[0][j].r2)) {
+            return nullptr;
+        }
+
+        // level k only has an entry starting at m if 2^k divides j
+        int top = levels.size() - 1;
+        int k = j ? std::min(std::countr_zero((unsigned)j), top) : top;
+        for (; k >= 0; k--) {
+            int i = j >> k;
+            if (i >= (int)levels[k].size()) continue;
+
+            const BLAStep<D>& step = levels[k][i];
+            if (z2 < step.r2 && step.l <= max_skip) {
+                return &step;
+            }
+        }
+        return nullptr;
+    }
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// gmp/mpfr memory backend with thread local pools of power of two blocks, so
+// render threads do not contend on the global malloc. blocks up to
+// GMP_POOL_MAX_BLOCK bytes come from the pools, larger ones from malloc.
+// has to be installed before the first gmp/mpfr allocation, memory allocated
+// before cannot be freed through it
+void gmp_allocator_install();
+bool gmp_allocator_installed();
+
+// allocations (including growing reallocations) and requested bytes since the
+// last reset, over all threads
+struct GMPAllocStats {
+    uint64_t allocs;
+    uint64_t bytes;
+};
+
+GMPAllocStats gmp_allocator_stats();
+void gmp_allocator_reset_stats();
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// rgb pixels, 3 bytes each, row by row from the top. both return false if the
+// file cannot be written
+bool write_ppm(const std::string& path, const std::vector<unsigned char>& rgb,
+               int width, int height);
+// png without compression: stored deflate blocks, so no zlib is needed
+bool write_png(const std::string& path, const std::vector<unsigned char>& rgb,
+               int width, int height);
+
+// png for paths ending in .png, ppm otherwise
+bool write_image(const std::string& path,
+                 const std::vector<unsigned char>& rgb, int width, int height);
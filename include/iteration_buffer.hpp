@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// pixels that ran into the iteration limit without being proven inside. z of
+// each is packed by the math funcs of the render, so raising the limit goes
+// on from where they stopped
+struct ResumeList {
+    // bytes of one packed z, both parts
+    size_t stride = 0;
+
+    std::vector<uint32_t> pixels;
+    // z of pixels[i] at i * stride
+    std::vector<unsigned char> z;
+    // pixels filled by subdivision without a z of their own, they start over
+    std::vector<uint32_t> restart;
+
+    // adds pixel and returns where its z goes
+    unsigned char* add(uint32_t pixel) {
+        pixels.push_back(pixel);
+        z.resize(z.size() + stride);
+        return z.data() + z.size() - stride;
+    }
+
+    size_t size() const { return pixels.size() + restart.size(); }
+
+    void clear() {
+        pixels.clear();
+        z.clear();
+        restart.clear();
+    }
+
+    // moves every pixel by -sx, -sy on a width x height image and drops the
+    // ones that leave it, see IterationBuffer::shift
+    void shift(int width, int height, int sx, int sy) {
+        auto moved = [&](uint32_t& pixel) {
+            int x = pixel % width - sx, y = pixel / width - sy;
+            if (x < 0 || x >= width || y < 0 || y >= height) return false;
+            pixel = y * width + x;
+            return true;
+        };
+
+        size_t kept = 0;
+        for (size_t i = 0; i < pixels.size(); i++) {
+            if (!moved(pixels[i])) continue;
+            if (kept != i) {
+                pixels[kept] = pixels[i];
+                std::copy_n(z.begin() + i * stride, stride,
+                            z.begin() + kept * stride);
+            }
+            kept++;
+        }
+        pixels.resize(kept);
+        z.resize(kept * stride);
+
+        std::erase_if(restart, [&](uint32_t& pixel) { return !moved(pixel); });
+    }
+
+    void append(const ResumeList& other) {
+        pixels.insert(pixels.end(), other.pixels.begin(), other.pixels.end());
+        z.insert(z.end(), other.z.begin(), other.z.end());
+        restart.insert(restart.end(), other.restart.begin(),
+                       other.restart.end());
+    }
+};
+
+// primary output of a render: the iteration count of every pixel and, with
+// SMOOTH_ITERATIONS, the fraction of an iteration left at the escape. the rgb
+// pixels are derived from it by colorize, so recoloring needs no rerender
+struct IterationBuffer {
+    int width = 0, height = 0;
+
+    // iteration limit the counts were computed with. counts equal to it are
+    // inside the set
+    int iterations = 0;
+
+    std::vector<uint32_t> iters;
+    // empty without smooth fractions
+    std::vector<float> smooth;
+
+    // with RESUMABLE_ITERATION, every pixel at the limit that may still
+    // escape. section renderers collect theirs and add them in one go
+    ResumeList resume;
+    std::mutex resume_mutex;
+
+    void resize(int _width, int _height, bool with_smooth) {
+        width = _width;
+        height = _height;
+        iters.resize((size_t)width * height);
+        smooth.resize(with_smooth ? (size_t)width * height : 0);
+    }
+
+    void add_resume(const ResumeList& list) {
+        if (list.size() == 0) return;
+        std::lock_guard<std::mutex> lock(resume_mutex);
+        resume.append(list);
+    }
+
+    // pixel x, y becomes pixel x - sx, y - sy, the pixels shifted in keep
+    // their old values until they are rendered
+    void shift(int sx, int sy) {
+        int w = width - std::abs(sx);
+        int src_x = std::max(sx, 0), dst_x = std::max(-sx, 0);
+        if (w <= 0 || std::abs(sy) >= height) return;
+
+        auto move_row = [&](int y) {
+            size_t dst = (size_t)y * width + dst_x;
+            size_t src = (size_t)(y + sy) * width + src_x;
+            std::memmove(&iters[dst], &iters[src], w * sizeof(uint32_t));
+            if (!smooth.empty()) {
+                std::memmove(&smooth[dst], &smooth[src], w * sizeof(float));
+            }
+        };
+
+        // rows are read before they are overwritten
+        if (sy >= 0) {
+            for (int y = 0; y < height - sy; y++) move_row(y);
+        } else {
+            for (int y = height - 1; y >= -sy; y--) move_row(y);
+        }
+
+        resume.shift(width, height, sx, sy);
+    }
+
+    // frac is the fraction of an iteration left at the escape, 0 if unknown
+    void set(int x, int y, int iter, float frac = 0.0f) {
+        size_t i = (size_t)y * width + x;
+        iters[i] = iter;
+        if (!smooth.empty()) smooth[i] = frac;
+    }
+
+    // fills the size x size block right of and below pixel x, y, clipped to
+    // the buffer and to clip_x, clip_y. coarse passes of a progressive render
+    // show up this way
+    void set_block(int x, int y, int size, int iter, float frac = 0.0f,
+                   int clip_x = INT_MAX, int clip_y = INT_MAX) {
+        int end_x = std::min({x + size, width, clip_x});
+        int end_y = std::min({y + size, height, clip_y});
+
+        for (int by = y; by < end_y; by++) {
+            for (int bx = x; bx < end_x; bx++) {
+                set(bx, by, iter, frac);
+            }
+        }
+    }
+};
+
+// fraction of an iteration left when an orbit escapes with |z|^2 = mag, for
+// continuous colouring. 1 right at the bailout of 4, 0 for orbits that jump to
+// |z| = 4
+inline float _smooth_fraction(double mag) {
+    if (!(mag > 1.0)) return 0.0f;
+    double f = 1.0 - std::log2(0.5 * std::log2(mag));
+    return (float)std::clamp(f, 0.0, 1.0);
+}
@@ -1,87 +1,400 @@
+#pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <climits>
+#include <cstdint>
 #include <iostream>
 #include <vector>
 
+#include "iteration_buffer.hpp"
 #include "math.hpp"
+#include "render_config.hpp"
+#include "scratch_arena.hpp"
+#include "thread_pool.hpp"
+
+// one pass of a progressive render. computes every step-th pixel of every
+// step-th row and fills its step x step block. after the first pass the
+// pixels on the grid of the previous pass (2 * step) are already done and are
+// skipped
+struct RenderPass {
+    int step = 1;
+    bool first = true;
+    // blocks stop at the end of their section instead of the image, for
+    // renders that must not touch pixels outside their sections
+    bool clip = false;
+
+    // cancel flag of the render, section renderers that run whole sections
+    // check it while they go
+    const std::atomic<bool>* cancelled = nullptr;
+
+    bool is_cancelled() const {
+        return cancelled && cancelled->load(std::memory_order_relaxed);
+    }
+
+    // clip argument of IterationBuffer::set_block for a section ending at end
+    int block_end(int end) const { return clip ? end : INT_MAX; }
+
+    // first row of the pass at or after start_y
+    int first_row(int start_y) const {
+        return (start_y + step - 1) / step * step;
+    }
+
+    // first pixel of the pass at or after start_x in row y, and the distance
+    // to the next one
+    void row(int y, int start_x, int& x, int& stride) const {
+        int offset = 0;
+        stride = step;
+        if (!first && y % (2 * step) == 0) {
+            offset = step;
+            stride = 2 * step;
+        }
+        x = (start_x - offset + stride - 1) / stride * stride + offset;
+    }
+
+    // whether pixel x, y on the grid of the pass is computed by it
+    bool owns(int x, int y) const {
+        return first || x % (2 * step) != 0 || y % (2 * step) != 0;
+    }
+
+    // fraction of the pixels of a section this pass computes
+    double share() const { return (first ? 1.0 : 0.75) / (step * step); }
+};
+
+// passes from a step of res (rounded down to a power of two) to full
+// resolution, coarsest first
+inline std::vector<RenderPass> _render_passes(int res) {
+    std::vector<RenderPass> passes;
+    for (int step = std::bit_floor((unsigned)std::max(res, 1)); step >= 1;
+         step /= 2) {
+        passes.push_back({step, passes.empty()});
+    }
+    return passes;
+}
+
+// whether c lies in the main cardioid or the period 2 bulb, which are both
+// inside the set. t0 and t1 are temporaries
+template <typename MType, MathFuncsConcept<MType> auto& M>
+bool _in_main_bulbs(MType& cx, MType& cy, MType& t0, MType& t1) {
+    // cardioid: q * (q + (x - 1/4)) <= y^2 / 4 with q = (x - 1/4)^2 + y^2
+    M.set_d(t0, 0.25);
+    M.sub(t0, cx, t0);
+    M.sqr(t1, t0);
+    M.fma(t1, cy, cy, t1);
+    M.add(t0, t1, t0);
+    M.mul(t0, t0, t1);
+    M.sqr(t1, cy);
+    M.mul_2si(t1, t1, -2);
+    if (M.cmp(t0, t1) <= 0) return true;
+
+    // bulb: (x + 1)^2 + y^2 <= 1/16
+    M.set_i(t0, 1);
+    M.add(t0, cx, t0);
+    M.sqr(t0, t0);
+    M.fma(t0, cy, cy, t0);
+    return M.cmp_d(t0, 1.0 / 16.0) <= 0;
+}
+
+// iterations the kernels ran on the calling thread, only counted with
+// RENDER_TRACE. RenderTrace starts it over for every section
+inline thread_local int64_t trace_iterations = 0;
+
+// iterates single pixels on temporaries borrowed for the lifetime of the
+// kernel. with INTERIOR_DETECTION pixels in the main bulbs and orbits that
+// come back to a saved point (brent's cycle detection, the saved point moves
+// on at every power of two) stop at iterations right away
+template <typename MType, MathFuncsConcept<MType> auto& M>
+struct MandelbrotKernel {
+    ScratchFrame<MType, M> scratch;
+    MType& tmp = scratch.get();
+    MType& zx2 = scratch.get();
+    MType& zy2 = scratch.get();
+    MType& nzx = scratch.get();
+    MType& nzy = scratch.get();
+    MType& tx = scratch.get();
+    MType& ty = scratch.get();
+    MType& cx = scratch.get();
+    MType& cy = scratch.get();
+    MType& zx = scratch.get();
+    MType& zy = scratch.get();
+    MType& sx = scratch.get();
+    MType& sy = scratch.get();
+    MType& eps = scratch.get();
+    MType& neg_eps = scratch.get();
+
+    // |z|^2 at the escape of the last pixel, 0 if it did not escape
+    double escape_mag;
+    // whether the last pixel was proven inside instead of running into the
+    // iteration limit
+    bool interior;
+
+    // iteration count of pixel x, y
+    int pixel(int iterations, MType& x_min, MType& y_min, int height, int x,
+              int y, MType& dx, MType& dy) {
+        _set_c(x_min, y_min, height, x, y, dx, dy);
+
+        if constexpr (INTERIOR_DETECTION) {
+            if (_in_main_bulbs<MType, M>(cx, cy, tx, ty)) {
+                escape_mag = 0.0;
+                interior = true;
+                return iterations;
+            }
+        }
+
+        M.set_i(zx, 0);
+        M.set_i(zy, 0);
+        return _iterate(iterations, 0, dx);
+    }
+
+    // iteration count of pixel x, y going on from z at iteration start. z is
+    // unpacked from packed_z
+    int resume(int iterations, int start, const unsigned char* packed_z,
+               MType& x_min, MType& y_min, int height, int x, int y,
+               MType& dx, MType& dy) {
+        _set_c(x_min, y_min, height, x, y, dx, dy);
+        M.unpack(zx, packed_z);
+        M.unpack(zy, packed_z + M.packed_size());
+        return _iterate(iterations, start, dx);
+    }
+
+    // packs z of the last pixel to out, 2 * M.packed_size() bytes
+    void save(unsigned char* out) {
+        M.pack(out, zx);
+        M.pack(out + M.packed_size(), zy);
+    }
+
+    // keeps the last pixel on resume if it may still escape
+    void keep(ResumeList& resume, int iterations, int iter, uint32_t index) {
+        if constexpr (RESUMABLE_ITERATION) {
+            if (iter == iterations && !interior) save(resume.add(index));
+        }
+    }
+
+    void _set_c(MType& x_min, MType& y_min, int height, int x, int y,
+                MType& dx, MType& dy) {
+        // map pixel coords to mandelbrot coords
+        M.set_i(tx, x);
+        M.set_i(ty, height - y);
+
+        // cx = min_x + tx * dx
+        M.fma(cx, tx, dx, x_min);
+        // cy = min_y + ty * dy
+        M.fma(cy, ty, dy, y_min);
+    }
+
+    int _iterate(int iterations, int iter, MType& dx) {
+        escape_mag = 0.0;
+        interior = false;
+
+        if constexpr (INTERIOR_DETECTION) {
+            // an orbit that returns within a fraction of the pixel spacing
+            // is periodic as far as this pixel can tell
+            M.set_d(eps, PERIODICITY_TOLERANCE);
+            M.mul(eps, eps, dx);
+            M.set_i(neg_eps, 0);
+            M.sub(neg_eps, neg_eps, eps);
+        }
+
+        // the cycle search starts over from the current z
+        M.set(sx, zx);
+        M.set(sy, zy);
+        int check_at = std::max(1, 2 * iter);
+        int from = iter;
+
+        for (; iter < iterations; iter++) {
+            // iterrate
+
+            // calculate zx^2 and zy^2
+            M.sqr(zx2, zx);
+            M.sqr(zy2, zy);
+
+            // check if magnitude > 4
+            M.add(tmp, zx2, zy2);
+            if (M.cmp_i(tmp, 4) > 0) {
+                if constexpr (SMOOTH_ITERATIONS) escape_mag = M.get_d(tmp);
+                break;
+            }
+
+            // z(n+1)x = z(n)x^2 - z(n)y^2 + cx
+            M.sub(nzx, zx2, zy2);
+            M.add(nzx, nzx, cx);
+            // z(n+1)y = 2 * z(n)x * z(n)y + cy
+            M.mul_2si(tmp, zx, 1);
+            M.fma(nzy, tmp, zy, cy);
+
+            // update z
+            M.swap(zx, nzx);
+            M.swap(zy, nzy);
+
+            if constexpr (INTERIOR_DETECTION) {
+                M.sub(tmp, zx, sx);
+                if (M.cmp(tmp, eps) < 0 && M.cmp(tmp, neg_eps) > 0) {
+                    M.sub(tmp, zy, sy);
+                    if (M.cmp(tmp, eps) < 0 && M.cmp(tmp, neg_eps) > 0) {
+                        if constexpr (RENDER_TRACE) {
+                            trace_iterations += iter + 1 - from;
+                        }
+                        interior = true;
+                        return iterations;
+                    }
+                }
+
+                if (iter == check_at) {
+                    M.set(sx, zx);
+                    M.set(sy, zy);
+                    check_at *= 2;
+                }
+            }
+        }
+        if constexpr (RENDER_TRACE) trace_iterations += iter - from;
+        return iter;
+    }
+};
 
 template <typename MType, MathFuncsConcept<MType> auto& M>
 void _mandelbrot_section_renderer(int iterations, MType& x_min, MType& y_min,
                                   int width, int height, int start_x, int end_x,
                                   int start_y, int end_y, MType& dx, MType& dy,
-                                  std::vector<unsigned char>& pixels) {
-    MType tmp, zx2, zy2, nzx, nzy, tx, ty, cx, cy, zx, zy, zero;
-    M.init(tmp);
-    M.init(zx2);
-    M.init(zy2);
-    M.init(nzx);
-    M.init(nzy);
-    M.init(tx);
-    M.init(ty);
-    M.init(cx);
-    M.init(cy);
-    M.init(zx);
-    M.init(zy);
-    M.init_set_i(zero, 0);
-
-    // init constants
-    MType two;
-    M.init_set_i(two, 2);
-
-    for (int y = start_y; y < end_y; y++) {
-        for (int x = start_x; x < end_x; x++) {
-            // map pixel coords to mandelbrot coords
-            M.set_i(tx, x);
-            M.set_i(ty, height - y);
-
-            // cy = min_x + ty * dx
-            M.mul(cx, tx, dx);
-            M.add(cx, cx, x_min);
-            // cy = min_y + ty * dy
-            M.mul(cy, ty, dy);
-            M.add(cy, cy, y_min);
-
-            M.set_i(zx, 0);
-            M.set_i(zy, 0);
-
-            int iter = 0;
-            for (; iter < iterations; iter++) {
-                // iterrate
-
-                // calculate zx^2 and zy^const 2
-                M.mul(zx2, zx, zx);
-                M.mul(zy2, zy, zy);
-
-                // check if magnitude > 4
-                M.add(tmp, zx2, zy2);
-                if (M.cmp_i(tmp, 4) > 0) {
-                    break;
-                }
+                                  const RenderPass& pass, IterationBuffer& out) {
+    MandelbrotKernel<MType, M> kernel;
+    ResumeList resume;
+    resume.stride = 2 * M.packed_size();
 
-                // Zn^2
+    for (int y = pass.first_row(start_y); y < end_y; y += pass.step) {
+        int x, stride;
+        pass.row(y, start_x, x, stride);
+        for (; x < end_x; x += stride) {
+            int iter =
+                kernel.pixel(iterations, x_min, y_min, height, x, y, dx, dy);
+            out.set_block(x, y, pass.step, iter,
+                          _smooth_fraction(kernel.escape_mag),
+                          pass.block_end(end_x), pass.block_end(end_y));
+            kernel.keep(resume, iterations, iter, y * width + x);
+        }
+    }
+    out.add_resume(resume);
+}
+
+// mariani-silver subdivision on the grid of pass. computes the border of a
+// rectangle and fills the inside if the whole border has the same iteration
+// count, otherwise splits the inside in two and recurses. rectangles of
+// SUBDIVISION_MIN_SIZE grid cells or less are computed pixel by pixel.
+// border pixels of earlier passes are read back from out instead of iterated.
+// filled pixels inside the set start over on resume unless the whole border
+// was computed by this pass and proven inside. a section is one rectangle, it
+// has to run as a single task and stops early on pass.cancelled. on a pool
+// worker, rectangles of at least SUBDIVISION_SPAWN_CELLS cells hand their
+// second half to the pool as a new section while another worker is idle
+template <typename MType, MathFuncsConcept<MType> auto& M>
+void _subdivision_section_renderer(int iterations, MType& x_min, MType& y_min,
+                                   int width, int height, int start_x,
+                                   int end_x, int start_y, int end_y, MType& dx,
+                                   MType& dy, const RenderPass& pass,
+                                   IterationBuffer& out) {
+    MandelbrotKernel<MType, M> kernel;
+    ResumeList resume;
+    resume.stride = 2 * M.packed_size();
+    int step = pass.step;
+    ThreadPool* pool = ThreadPool::current();
+
+    // whether the last cell compute returned was proven inside
+    bool interior = false;
+
+    // iterates grid cell gx, gy and writes it if it belongs to the pass,
+    // cells of earlier passes are already in out
+    auto compute = [&](int gx, int gy) {
+        int x = gx * step, y = gy * step;
+        interior = false;
+        if (!pass.owns(x, y)) {
+            return (int)out.iters[(size_t)y * out.width + x];
+        }
 
-                // z(n+1)x = z(n)x^2 - z(n)y^2
-                M.sub(nzx, zx2, zy2);
-                // z(n+1)y = 2 * z(n)x * z(n)y
-                M.mul(nzy, two, zx);
-                M.mul(nzy, nzy, zy);
+        int iter = kernel.pixel(iterations, x_min, y_min, height, x, y, dx, dy);
+        interior = kernel.interior;
+        out.set_block(x, y, step, iter, _smooth_fraction(kernel.escape_mag),
+                      pass.block_end(end_x), pass.block_end(end_y));
+        kernel.keep(resume, iterations, iter, y * width + x);
+        return iter;
+    };
 
-                // + C
-                M.add(nzx, nzx, cx);
-                M.add(nzy, nzy, cy);
+    // cells [gx0, gx1) x [gy0, gy1)
+    auto subdivide = [&](auto& self, int gx0, int gy0, int gx1,
+                         int gy1) -> void {
+        int w = gx1 - gx0, h = gy1 - gy0;
+        // before the border and the splits, a cancel stops within one border
+        if (w <= 0 || h <= 0 || pass.is_cancelled()) return;
 
-                // update z
-                M.set(zx, nzx);
-                M.set(zy, nzy);
+        if (w <= SUBDIVISION_MIN_SIZE || h <= SUBDIVISION_MIN_SIZE) {
+            for (int gy = gy0; gy < gy1; gy++) {
+                for (int gx = gx0; gx < gx1; gx++) {
+                    compute(gx, gy);
+                }
             }
+            return;
+        }
 
-            // std::cout << x << " " << y << " " << iter << "\n";
-            //  map iter to color
-            unsigned char color = (unsigned char)(255.0f * iter / iterations);
-            size_t idx = (y * width + x) * 3;
-            pixels[idx + 0] = color;
-            pixels[idx + 1] = color;
-            pixels[idx + 2] = color;
+        int first = compute(gx0, gy0);
+        bool uniform = true;
+        bool proven = interior;
+        auto border = [&](int gx, int gy) {
+            if (compute(gx, gy) != first) uniform = false;
+            proven = proven && interior;
+        };
+        for (int gx = gx0 + 1; gx < gx1; gx++) {
+            border(gx, gy0);
+            border(gx, gy1 - 1);
         }
-        // std::cout << "c" << y << "\n";
-    }
+        border(gx0, gy1 - 1);
+        for (int gy = gy0 + 1; gy < gy1 - 1; gy++) {
+            border(gx0, gy);
+            border(gx1 - 1, gy);
+        }
+
+        // a filled band would lose its smooth fractions, only the inside is
+        // filled when they are kept
+        if (uniform && (out.smooth.empty() || first == iterations)) {
+            for (int gy = gy0 + 1; gy < gy1 - 1; gy++) {
+                for (int gx = gx0 + 1; gx < gx1 - 1; gx++) {
+                    int x = gx * step, y = gy * step;
+                    if (pass.owns(x, y)) {
+                        out.set_block(x, y, step, first, 0.0f,
+                                      pass.block_end(end_x),
+                                      pass.block_end(end_y));
+                        if (RESUMABLE_ITERATION && first == iterations &&
+                            !proven) {
+                            resume.restart.push_back(y * width + x);
+                        }
+                    }
+                }
+            }
+            return;
+        }
+
+        // split the inside along its longer side into [gx0, gy0, gx1, gy1)
+        // and [hx0, hy0, hx1, hy1)
+        gx0++, gy0++, gx1--, gy1--;
+        int hx0 = gx0, hy0 = gy0, hx1 = gx1, hy1 = gy1;
+        if (gx1 - gx0 >= gy1 - gy0) {
+            gx1 = hx0 = (gx0 + gx1) / 2;
+        } else {
+            gy1 = hy0 = (gy0 + gy1) / 2;
+        }
+
+        // an idle worker takes the second half as a section of its own, it
+        // ends on the grid or at the end of this section
+        bool spawn = pool &&
+                     (hx1 - hx0) * (hy1 - hy0) >= SUBDIVISION_SPAWN_CELLS &&
+                     pool->wants_work();
+        if (spawn) {
+            pool->spawn({hx0 * step, std::min(hx1 * step, end_x), hy0 * step,
+                         std::min(hy1 * step, end_y)});
+        }
+        self(self, gx0, gy0, gx1, gy1);
+        if (!spawn) self(self, hx0, hy0, hx1, hy1);
+    };
+
+    subdivide(subdivide, (start_x + step - 1) / step, (start_y + step - 1) / step,
+              (end_x + step - 1) / step, (end_y + step - 1) / step);
+    out.add_resume(resume);
 }
@@ -3,15 +3,32 @@
 #include <gmp.h>
 #include <mpfr.h>
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+
 #include "render_config.hpp"
 
 template <typename M, typename T>
-concept MathFuncsConcept = requires(T a, T b, T c, int i, double d) {
+concept MathFuncsConcept = requires(T a, T b, T c, T e, int i, double d,
+                                    void* p, const void* q) {
     { M::init(a) };
     { M::add(a, b, c) };
     { M::sub(a, b, c) };
     { M::mul(a, b, c) };
     { M::div(a, b, c) };
+    // a = b^2
+    { M::sqr(a, b) };
+    // a = b * 2^i
+    { M::mul_2si(a, b, i) };
+    // a = b * c + e and a = b * c - e, fused where the type can
+    { M::fma(a, b, c, e) };
+    { M::fms(a, b, c, e) };
+    { M::swap(a, b) };
     { M::set(a, b) };
     { M::set_i(a, i) };
     { M::set_d(a, d) };
@@ -24,32 +41,13 @@ concept MathFuncsConcept = requires(T a, T b, T c, int i, double d) {
     { M::cmp_i(a, i) };
     { M::cmp_d(a, d) };
     { M::clear(a) };
+    // fixed size byte form of a number of the current precision, for storing
+    // many of them without one allocation each
+    { M::packed_size() };
+    { M::pack(p, a) };
+    { M::unpack(a, q) };
 };
 
-template <typename MType, MathFuncsConcept<MType> auto& M>
-void map(MType& out, MType& x, MType& min_1, MType& max_1, MType& min_2,
-         MType& max_2) {
-    MType scaled_x;
-    MType range_1;
-    MType range_2;
-
-    M.init(scaled_x);
-    M.init(range_1);
-    M.init(range_2);
-
-    M.sub(scaled_x, x, min_1);
-    M.sub(range_2, max_2, min_2);
-    M.sub(range_1, max_1, min_1);
-
-    M.mul(out, scaled_x, range_2);
-    M.div(out, out, range_1);
-    M.add(out, out, min_2);
-
-    M.clear(scaled_x);
-    M.clear(range_1);
-    M.clear(range_2);
-}
-
 template <typename MType>
 struct FractalBounds {
     double d_x_min, d_x_max;
@@ -108,6 +106,50 @@ struct FractalBounds {
         M.init(height);
     }
 
+    // initializes this as a copy of other, used to snapshot the bounds a
+    // render job works on
+    template <MathFuncsConcept<MType> auto& M>
+    void init_copy(FractalBounds& other) {
+        other.get_aux_bounds(d_x_min, d_x_max, d_y_min, d_y_max, i_width,
+                             i_height);
+
+        M.init_set(x_min, other.x_min);
+        M.init_set(x_max, other.x_max);
+        M.init_set(y_min, other.y_min);
+        M.init_set(y_max, other.y_max);
+        M.init_set(r_x_min, other.r_x_min);
+        M.init_set(r_x_max, other.r_x_max);
+        M.init_set(r_y_min, other.r_y_min);
+        M.init_set(r_y_max, other.r_y_max);
+        M.init_set(width, other.width);
+        M.init_set(height, other.height);
+    }
+
+    // whether other covers the same region at the same size, so pixels of a
+    // render of one are pixels of the other
+    template <MathFuncsConcept<MType> auto& M>
+    bool same_view(FractalBounds& other) {
+        return i_width == other.i_width && i_height == other.i_height &&
+               M.cmp(x_min, other.x_min) == 0 &&
+               M.cmp(x_max, other.x_max) == 0 &&
+               M.cmp(y_min, other.y_min) == 0 &&
+               M.cmp(y_max, other.y_max) == 0;
+    }
+
+    template <MathFuncsConcept<MType> auto& M>
+    void clear() {
+        M.clear(x_min);
+        M.clear(x_max);
+        M.clear(y_min);
+        M.clear(y_max);
+        M.clear(r_x_min);
+        M.clear(r_x_max);
+        M.clear(r_y_min);
+        M.clear(r_y_max);
+        M.clear(width);
+        M.clear(height);
+    }
+
     template <MathFuncsConcept<MType> auto& M>
     void set_bounds_d(double _x_min, double _x_max, double _y_min,
                       double _y_max) {
@@ -134,7 +176,38 @@ struct FractalBounds {
     }
 };
 
-enum class MathType { DOUBLE, FLOAT, MPFR, MPQ };
+enum class MathType {
+    DOUBLE,
+    FLOAT,
+    MPFR,
+    MPQ,
+    PERTURBATION,
+    BLA,
+    DOUBLE_DOUBLE,
+    FIXED_POINT
+};
+
+inline const char* math_type_name(MathType type) {
+    switch (type) {
+        case MathType::DOUBLE:
+            return "double";
+        case MathType::FLOAT:
+            return "float";
+        case MathType::MPFR:
+            return "mpfr";
+        case MathType::MPQ:
+            return "mpq";
+        case MathType::PERTURBATION:
+            return "perturbation";
+        case MathType::BLA:
+            return "bla";
+        case MathType::DOUBLE_DOUBLE:
+            return "double-double";
+        case MathType::FIXED_POINT:
+            return "fixed-point";
+    }
+    return "unknown";
+}
 
 struct DoubleMathFuncs {
     inline static void init(double& n) { (void)n; }
@@ -144,6 +217,19 @@ struct DoubleMathFuncs {
     inline static void mul(double& n, double& a, double& b) { n = a * b; }
     inline static void div(double& n, double& a, double& b) { n = a / b; }
 
+    inline static void sqr(double& n, double& a) { n = a * a; }
+    inline static void mul_2si(double& n, double& a, int e) {
+        n = std::ldexp(a, e);
+    }
+    // left to the compiler to contract, like the simd kernels
+    inline static void fma(double& n, double& a, double& b, double& c) {
+        n = a * b + c;
+    }
+    inline static void fms(double& n, double& a, double& b, double& c) {
+        n = a * b - c;
+    }
+    inline static void swap(double& a, double& b) { std::swap(a, b); }
+
     inline static void set(double& n, double& x) { n = x; }
     inline static void set_i(double& n, int x) { n = (double)x; }
     inline static void set_d(double& n, double x) { n = x; };
@@ -158,16 +244,25 @@ struct DoubleMathFuncs {
     inline static int cmp(double& a, double& b) {
         return (a == b ? 0 : (a > b ? 1 : -1));
     }
-    inline static int cmp_i(double& a, int b) {
-        return ((int)a == b ? 0 : ((int)a > b ? 1 : -1));
+    inline static int cmp_i(double& a, int b) { return cmp_d(a, (double)b); }
+    inline static int cmp_d(double& a, double b) {
+        return (a == b ? 0 : (a > b ? 1 : -1));
     }
-    inline static int cmp_d(double& a, double b) { return cmp(a, b); }
 
     inline static void clear(double& a) { (void)a; }
+    inline static size_t packed_size() { return sizeof(double); }
+    inline static void pack(void* out, double& n) {
+        std::memcpy(out, &n, sizeof(double));
+    }
+    inline static void unpack(double& n, const void* in) {
+        std::memcpy(&n, in, sizeof(double));
+    }
 };
 
 struct MPFRMathFuncs {
-    inline static mpfr_prec_t prec = START_MPFR_PREC;
+    // per thread. the ui thread works at the precision of the view, a job
+    // thread at that of its job and pool workers at that of the run
+    inline static thread_local mpfr_prec_t prec = START_MPFR_PREC;
     const static mpfr_rnd_t rnd = MPFR_RNDN;
 
     inline static void init(mpfr_t n) { mpfr_init2(n, prec); }
@@ -185,6 +280,18 @@ struct MPFRMathFuncs {
         mpfr_div(n, a, b, rnd);
     }
 
+    inline static void sqr(mpfr_t n, mpfr_t a) { mpfr_sqr(n, a, rnd); }
+    inline static void mul_2si(mpfr_t n, mpfr_t a, int e) {
+        mpfr_mul_2si(n, a, e, rnd);
+    }
+    inline static void fma(mpfr_t n, mpfr_t a, mpfr_t b, mpfr_t c) {
+        mpfr_fma(n, a, b, c, rnd);
+    }
+    inline static void fms(mpfr_t n, mpfr_t a, mpfr_t b, mpfr_t c) {
+        mpfr_fms(n, a, b, c, rnd);
+    }
+    inline static void swap(mpfr_t a, mpfr_t b) { mpfr_swap(a, b); }
+
     inline static void set(mpfr_t n, mpfr_t x) { mpfr_set(n, x, rnd); }
     inline static void set_i(mpfr_t n, int x) { mpfr_set_si(n, x, rnd); }
     inline static void set_d(mpfr_t n, double x) { mpfr_set_d(n, x, rnd); }
@@ -208,4 +315,532 @@ struct MPFRMathFuncs {
     inline static int cmp_d(mpfr_t a, double b) { return mpfr_cmp_d(a, b); }
 
     inline static void clear(mpfr_t n) { mpfr_clear(n); }
+
+    // exponent and kind, then the significand limbs. a custom mpfr_t on the
+    // bytes reads and writes them without allocating
+    constexpr static size_t PACKED_HEADER = 2 * sizeof(mp_limb_t);
+    static_assert(sizeof(mpfr_exp_t) + sizeof(int) <= PACKED_HEADER);
+
+    inline static size_t packed_size() {
+        return PACKED_HEADER + mpfr_custom_get_size(prec);
+    }
+    inline static void pack(void* out, mpfr_t n) {
+        unsigned char* bytes = (unsigned char*)out;
+        mpfr_t view;
+        mpfr_custom_init(bytes + PACKED_HEADER, prec);
+        mpfr_custom_init_set(view, MPFR_ZERO_KIND, 0, prec,
+                             bytes + PACKED_HEADER);
+        mpfr_set(view, n, rnd);
+
+        // negative kinds are negative numbers
+        int kind = mpfr_custom_get_kind(view);
+        mpfr_exp_t exp = 0;
+        if (kind == MPFR_REGULAR_KIND || kind == -MPFR_REGULAR_KIND) {
+            exp = mpfr_custom_get_exp(view);
+        }
+        std::memcpy(bytes, &exp, sizeof(exp));
+        std::memcpy(bytes + sizeof(exp), &kind, sizeof(kind));
+    }
+    inline static void unpack(mpfr_t n, const void* in) {
+        unsigned char* bytes = (unsigned char*)in;
+        mpfr_exp_t exp;
+        int kind;
+        std::memcpy(&exp, bytes, sizeof(exp));
+        std::memcpy(&kind, bytes + sizeof(exp), sizeof(kind));
+
+        mpfr_t view;
+        mpfr_custom_init_set(view, kind, exp, prec, bytes + PACKED_HEADER);
+        mpfr_set(n, view, rnd);
+    }
+};
+
+// unevaluated sum hi + lo with |lo| <= ulp(hi) / 2, about 106 bits of mantissa
+// with the exponent range of a double
+struct DoubleDouble {
+    double hi, lo;
+};
+
+struct DoubleDoubleMathFuncs {
+    // error free transforms: s + e == a + b and p + e == a * b exactly
+    inline static void two_sum(double a, double b, double& s, double& e) {
+        s = a + b;
+        double bb = s - a;
+        e = (a - (s - bb)) + (b - bb);
+    }
+    // requires |a| >= |b|
+    inline static void quick_two_sum(double a, double b, double& s,
+                                     double& e) {
+        s = a + b;
+        e = b - (s - a);
+    }
+    inline static void two_prod(double a, double b, double& p, double& e) {
+        p = a * b;
+        e = std::fma(a, b, -p);
+    }
+
+    inline static DoubleDouble mul_d(const DoubleDouble& a, double b) {
+        double p, e;
+        two_prod(a.hi, b, p, e);
+        e += a.lo * b;
+
+        DoubleDouble r;
+        quick_two_sum(p, e, r.hi, r.lo);
+        return r;
+    }
+
+    // n may alias a or b in every operation
+    inline static void init(DoubleDouble& n) { n = {0.0, 0.0}; }
+
+    inline static void add(DoubleDouble& n, DoubleDouble& a, DoubleDouble& b) {
+        double s, e, t, f;
+        two_sum(a.hi, b.hi, s, e);
+        two_sum(a.lo, b.lo, t, f);
+        e += t;
+        quick_two_sum(s, e, s, e);
+        e += f;
+        quick_two_sum(s, e, n.hi, n.lo);
+    }
+    inline static void sub(DoubleDouble& n, DoubleDouble& a, DoubleDouble& b) {
+        DoubleDouble neg_b = {-b.hi, -b.lo};
+        add(n, a, neg_b);
+    }
+    inline static void mul(DoubleDouble& n, DoubleDouble& a, DoubleDouble& b) {
+        double p, e;
+        two_prod(a.hi, b.hi, p, e);
+        e += a.hi * b.lo + a.lo * b.hi;
+        quick_two_sum(p, e, n.hi, n.lo);
+    }
+    inline static void div(DoubleDouble& n, DoubleDouble& a, DoubleDouble& b) {
+        // long division, every quotient digit removes ~53 bits of the rest
+        double q1 = a.hi / b.hi;
+        DoubleDouble t = mul_d(b, q1);
+        DoubleDouble r;
+        sub(r, a, t);
+
+        double q2 = r.hi / b.hi;
+        t = mul_d(b, q2);
+        sub(r, r, t);
+
+        double q3 = r.hi / b.hi;
+
+        DoubleDouble q, _q3 = {q3, 0.0};
+        quick_two_sum(q1, q2, q.hi, q.lo);
+        add(n, q, _q3);
+    }
+
+    inline static void sqr(DoubleDouble& n, DoubleDouble& a) {
+        double p, e;
+        two_prod(a.hi, a.hi, p, e);
+        e += 2.0 * a.hi * a.lo;
+        quick_two_sum(p, e, n.hi, n.lo);
+    }
+    inline static void mul_2si(DoubleDouble& n, DoubleDouble& a, int e) {
+        n = {std::ldexp(a.hi, e), std::ldexp(a.lo, e)};
+    }
+    inline static void fma(DoubleDouble& n, DoubleDouble& a, DoubleDouble& b,
+                           DoubleDouble& c) {
+        DoubleDouble p;
+        mul(p, a, b);
+        add(n, p, c);
+    }
+    inline static void fms(DoubleDouble& n, DoubleDouble& a, DoubleDouble& b,
+                           DoubleDouble& c) {
+        DoubleDouble p;
+        mul(p, a, b);
+        sub(n, p, c);
+    }
+    inline static void swap(DoubleDouble& a, DoubleDouble& b) {
+        std::swap(a, b);
+    }
+
+    inline static void set(DoubleDouble& n, DoubleDouble& x) { n = x; }
+    inline static void set_i(DoubleDouble& n, int x) { n = {(double)x, 0.0}; }
+    inline static void set_d(DoubleDouble& n, double x) { n = {x, 0.0}; }
+    inline static void init_set(DoubleDouble& n, DoubleDouble& x) { n = x; }
+    inline static void init_set_i(DoubleDouble& n, int x) { set_i(n, x); }
+    inline static void init_set_d(DoubleDouble& n, double x) { set_d(n, x); }
+    inline static int get_i(DoubleDouble& n) { return (int)(n.hi + n.lo); }
+    inline static double get_d(DoubleDouble& n) { return n.hi + n.lo; }
+
+    inline static int cmp(DoubleDouble& a, DoubleDouble& b) {
+        if (a.hi != b.hi) return a.hi > b.hi ? 1 : -1;
+        if (a.lo != b.lo) return a.lo > b.lo ? 1 : -1;
+        return 0;
+    }
+    inline static int cmp_i(DoubleDouble& a, int b) {
+        DoubleDouble _b = {(double)b, 0.0};
+        return cmp(a, _b);
+    }
+    inline static int cmp_d(DoubleDouble& a, double b) {
+        DoubleDouble _b = {b, 0.0};
+        return cmp(a, _b);
+    }
+
+    inline static void clear(DoubleDouble& n) { (void)n; }
+    inline static size_t packed_size() { return sizeof(DoubleDouble); }
+    inline static void pack(void* out, DoubleDouble& n) {
+        std::memcpy(out, &n, sizeof(DoubleDouble));
+    }
+    inline static void unpack(DoubleDouble& n, const void* in) {
+        std::memcpy(&n, in, sizeof(DoubleDouble));
+    }
+};
+
+// two's complement fixed point number of N limbs: the top limb is the integer
+// part, the other N - 1 limbs are the fraction. no exponent, rounding mode or
+// normalization, which the orbit does not need since |z| stays small
+template <int N>
+struct FixedPoint {
+    static_assert(N >= 2, "FixedPoint needs at least one fraction limb");
+    static_assert(GMP_NUMB_BITS == 64 && GMP_NAIL_BITS == 0,
+                  "FixedPoint expects 64 bit limbs without nails");
+
+    mp_limb_t limbs[N];
+};
+
+template <int N>
+struct FixedPointMathFuncs {
+    // writes |x| to out and returns whether x is negative
+    inline static bool abs(mp_limb_t* out, const FixedPoint<N>& x) {
+        bool neg = (int64_t)x.limbs[N - 1] < 0;
+        if (neg) {
+            mpn_neg(out, x.limbs, N);
+        } else {
+            mpn_copyi(out, x.limbs, N);
+        }
+        return neg;
+    }
+
+    // n may alias a or b in every operation
+    inline static void init(FixedPoint<N>& n) { mpn_zero(n.limbs, N); }
+
+    inline static void add(FixedPoint<N>& n, FixedPoint<N>& a,
+                           FixedPoint<N>& b) {
+        mpn_add_n(n.limbs, a.limbs, b.limbs, N);
+    }
+    inline static void sub(FixedPoint<N>& n, FixedPoint<N>& a,
+                           FixedPoint<N>& b) {
+        mpn_sub_n(n.limbs, a.limbs, b.limbs, N);
+    }
+    inline static void mul(FixedPoint<N>& n, FixedPoint<N>& a,
+                           FixedPoint<N>& b) {
+        mp_limb_t _a[N], _b[N], p[2 * N];
+        bool neg = abs(_a, a) != abs(_b, b);
+
+        // the product has 2 * (N - 1) fraction limbs, drop the lowest N - 1
+        if (&a == &b) {
+            mpn_sqr(p, _a, N);
+        } else {
+            mpn_mul_n(p, _a, _b, N);
+        }
+        if (neg) {
+            mpn_neg(n.limbs, p + N - 1, N);
+        } else {
+            mpn_copyi(n.limbs, p + N - 1, N);
+        }
+    }
+    inline static void div(FixedPoint<N>& n, FixedPoint<N>& a,
+                           FixedPoint<N>& b) {
+        mp_limb_t _a[2 * N - 1], _b[N], q[2 * N], r[N];
+        mpn_zero(_a, N - 1);
+        bool neg = abs(_a + N - 1, a) != abs(_b, b);
+
+        // mpn_tdiv_qr needs a divisor without leading zero limbs
+        mp_size_t b_size = N;
+        while (b_size > 0 && _b[b_size - 1] == 0) b_size--;
+        if (b_size == 0) {
+            init(n);
+            return;
+        }
+
+        // a * 2^(64 * (N - 1)) / b keeps N - 1 fraction limbs
+        mpn_tdiv_qr(q, r, 0, _a, 2 * N - 1, _b, b_size);
+        if (neg) {
+            mpn_neg(n.limbs, q, N);
+        } else {
+            mpn_copyi(n.limbs, q, N);
+        }
+    }
+
+    inline static void sqr(FixedPoint<N>& n, FixedPoint<N>& a) { mul(n, a, a); }
+    inline static void mul_2si(FixedPoint<N>& n, FixedPoint<N>& a, int e) {
+        mp_limb_t _a[N];
+        bool neg = abs(_a, a);
+
+        // whole limbs are moved, the rest is shifted. bits shifted out at the
+        // bottom are truncated like in mul
+        int limbs = std::min(std::abs(e) / 64, N);
+        unsigned bits = std::abs(e) % 64;
+        if (e >= 0) {
+            for (int i = N - 1; i >= 0; i--) {
+                _a[i] = i >= limbs ? _a[i - limbs] : 0;
+            }
+            if (bits) mpn_lshift(_a, _a, N, bits);
+        } else {
+            for (int i = 0; i < N; i++) {
+                _a[i] = i + limbs < N ? _a[i + limbs] : 0;
+            }
+            if (bits) mpn_rshift(_a, _a, N, bits);
+        }
+
+        if (neg) {
+            mpn_neg(n.limbs, _a, N);
+        } else {
+            mpn_copyi(n.limbs, _a, N);
+        }
+    }
+    inline static void fma(FixedPoint<N>& n, FixedPoint<N>& a,
+                           FixedPoint<N>& b, FixedPoint<N>& c) {
+        FixedPoint<N> p;
+        mul(p, a, b);
+        add(n, p, c);
+    }
+    inline static void fms(FixedPoint<N>& n, FixedPoint<N>& a,
+                           FixedPoint<N>& b, FixedPoint<N>& c) {
+        FixedPoint<N> p;
+        mul(p, a, b);
+        sub(n, p, c);
+    }
+    inline static void swap(FixedPoint<N>& a, FixedPoint<N>& b) {
+        std::swap(a, b);
+    }
+
+    inline static void set(FixedPoint<N>& n, FixedPoint<N>& x) { n = x; }
+    inline static void set_i(FixedPoint<N>& n, int x) {
+        mpn_zero(n.limbs, N - 1);
+        n.limbs[N - 1] = (mp_limb_t)(int64_t)x;
+    }
+    inline static void set_d(FixedPoint<N>& n, double x) {
+        // scaling by 2^64 is exact, so are the limbs
+        double a = std::abs(x);
+        for (int i = N - 1; i >= 0; i--) {
+            double limb = std::floor(a);
+            n.limbs[i] = (mp_limb_t)limb;
+            a = (a - limb) * 0x1p64;
+        }
+        if (x < 0.0) {
+            mpn_neg(n.limbs, n.limbs, N);
+        }
+    }
+    inline static void init_set(FixedPoint<N>& n, FixedPoint<N>& x) { n = x; }
+    inline static void init_set_i(FixedPoint<N>& n, int x) { set_i(n, x); }
+    inline static void init_set_d(FixedPoint<N>& n, double x) { set_d(n, x); }
+    inline static int get_i(FixedPoint<N>& n) {
+        mp_limb_t _n[N];
+        bool neg = abs(_n, n);
+        return neg ? -(int)_n[N - 1] : (int)_n[N - 1];
+    }
+    inline static double get_d(FixedPoint<N>& n) {
+        mp_limb_t _n[N];
+        bool neg = abs(_n, n);
+
+        double d = 0.0;
+        for (int i = 0; i < N; i++) {
+            d += std::ldexp((double)_n[i], 64 * (i - (N - 1)));
+        }
+        return neg ? -d : d;
+    }
+
+    inline static int cmp(FixedPoint<N>& a, FixedPoint<N>& b) {
+        int64_t top_a = a.limbs[N - 1], top_b = b.limbs[N - 1];
+        if (top_a != top_b) return top_a > top_b ? 1 : -1;
+        return mpn_cmp(a.limbs, b.limbs, N - 1);
+    }
+    inline static int cmp_i(FixedPoint<N>& a, int b) {
+        FixedPoint<N> _b;
+        set_i(_b, b);
+        return cmp(a, _b);
+    }
+    inline static int cmp_d(FixedPoint<N>& a, double b) {
+        FixedPoint<N> _b;
+        set_d(_b, b);
+        return cmp(a, _b);
+    }
+
+    inline static void clear(FixedPoint<N>& n) { (void)n; }
+    inline static size_t packed_size() { return sizeof(FixedPoint<N>); }
+    inline static void pack(void* out, FixedPoint<N>& n) {
+        std::memcpy(out, &n, sizeof(FixedPoint<N>));
+    }
+    inline static void unpack(FixedPoint<N>& n, const void* in) {
+        std::memcpy(&n, in, sizeof(FixedPoint<N>));
+    }
+};
+
+// double mantissa with a separate 64 bit exponent: m * 2^e with
+// 0.5 <= |m| < 1, or m == 0. same precision as a double, but pixel spacings
+// and deltas of deep zooms neither under- nor overflow
+struct FloatExp {
+    double m = 0.0;
+    int64_t e = 0;
+
+    FloatExp() = default;
+    FloatExp(double d) { *this = normalized(d, 0); }
+
+    // m * 2^e. the exponent is read from the bits of m instead of frexp,
+    // which only zero, subnormals, inf and nan need
+    static FloatExp normalized(double m, int64_t e) {
+        uint64_t bits = std::bit_cast<uint64_t>(m);
+        int biased = (bits >> 52) & 0x7ff;
+
+        FloatExp r;
+        if (biased == 0 || biased == 0x7ff) {
+            int _e;
+            r.m = std::frexp(m, &_e);
+            r.e = r.m == 0.0 ? 0 : e + _e;
+            return r;
+        }
+
+        // keep sign and fraction, set the exponent of [0.5, 1)
+        bits = (bits & ~(0x7ffull << 52)) | (1022ull << 52);
+        r.m = std::bit_cast<double>(bits);
+        r.e = e + biased - 1022;
+        return r;
+    }
+
+    // 2^e for -1022 <= e <= 1023
+    static double exp2(int64_t e) {
+        return std::bit_cast<double>((uint64_t)(e + 1023) << 52);
+    }
+
+    explicit operator double() const {
+        if (m == 0.0) return m;
+        if (e >= -1022 && e <= 1023) return m * exp2(e);
+        if (e < std::numeric_limits<double>::min_exponent - 64) return 0.0 * m;
+        if (e > std::numeric_limits<double>::max_exponent) {
+            return m * std::numeric_limits<double>::infinity();
+        }
+        return std::ldexp(m, (int)e);
+    }
+
+    // returns positive value if (a > b), zero if (a == b) and negative value
+    // if (a < b)
+    static int cmp(const FloatExp& a, const FloatExp& b) {
+        int sign_a = (a.m > 0.0) - (a.m < 0.0);
+        int sign_b = (b.m > 0.0) - (b.m < 0.0);
+        if (sign_a != sign_b) return sign_a > sign_b ? 1 : -1;
+        if (sign_a == 0) return 0;
+        if (a.e != b.e) return a.e > b.e ? sign_a : -sign_a;
+        return (a.m == b.m ? 0 : (a.m > b.m ? 1 : -1));
+    }
+};
+
+inline FloatExp operator-(const FloatExp& a) {
+    FloatExp r = a;
+    r.m = -r.m;
+    return r;
+}
+inline FloatExp operator+(const FloatExp& a, const FloatExp& b) {
+    if (a.m == 0.0) return b;
+    if (b.m == 0.0) return a;
+
+    // align the smaller operand, beyond 64 bits it cannot change the sum
+    const FloatExp& big = a.e >= b.e ? a : b;
+    const FloatExp& small = a.e >= b.e ? b : a;
+    int64_t shift = big.e - small.e;
+    if (shift > 64) return big;
+
+    return FloatExp::normalized(big.m + small.m * FloatExp::exp2(-shift),
+                                big.e);
+}
+inline FloatExp operator-(const FloatExp& a, const FloatExp& b) {
+    return a + -b;
+}
+inline FloatExp operator*(const FloatExp& a, const FloatExp& b) {
+    return FloatExp::normalized(a.m * b.m, a.e + b.e);
+}
+inline FloatExp operator/(const FloatExp& a, const FloatExp& b) {
+    return FloatExp::normalized(a.m / b.m, a.e - b.e);
+}
+inline bool operator<(const FloatExp& a, const FloatExp& b) {
+    return FloatExp::cmp(a, b) < 0;
+}
+inline bool operator>(const FloatExp& a, const FloatExp& b) {
+    return FloatExp::cmp(a, b) > 0;
+}
+inline bool operator<=(const FloatExp& a, const FloatExp& b) {
+    return FloatExp::cmp(a, b) <= 0;
+}
+inline bool operator>=(const FloatExp& a, const FloatExp& b) {
+    return FloatExp::cmp(a, b) >= 0;
+}
+inline FloatExp abs(const FloatExp& a) { return a.m < 0.0 ? -a : a; }
+inline FloatExp sqrt(const FloatExp& a) {
+    if (a.m == 0.0) return a;
+
+    // make the exponent even so it can be halved exactly
+    double m = a.m;
+    int64_t e = a.e;
+    if (e & 1) {
+        m *= 2.0;
+        e -= 1;
+    }
+    return FloatExp::normalized(std::sqrt(m), e / 2);
+}
+
+inline FloatExp to_floatexp(double d) { return FloatExp(d); }
+inline FloatExp to_floatexp(mpfr_srcptr n) {
+    long e;
+    double m = mpfr_get_d_2exp(&e, n, MPFR_RNDN);
+    return FloatExp::normalized(m, e);
+}
+
+struct FloatExpMathFuncs {
+    inline static void init(FloatExp& n) { n = FloatExp(); }
+
+    inline static void add(FloatExp& n, FloatExp& a, FloatExp& b) {
+        n = a + b;
+    }
+    inline static void sub(FloatExp& n, FloatExp& a, FloatExp& b) {
+        n = a - b;
+    }
+    inline static void mul(FloatExp& n, FloatExp& a, FloatExp& b) {
+        n = a * b;
+    }
+    inline static void div(FloatExp& n, FloatExp& a, FloatExp& b) {
+        n = a / b;
+    }
+
+    inline static void sqr(FloatExp& n, FloatExp& a) { n = a * a; }
+    inline static void mul_2si(FloatExp& n, FloatExp& a, int e) {
+        n = a;
+        if (n.m != 0.0) n.e += e;
+    }
+    inline static void fma(FloatExp& n, FloatExp& a, FloatExp& b,
+                           FloatExp& c) {
+        n = a * b + c;
+    }
+    inline static void fms(FloatExp& n, FloatExp& a, FloatExp& b,
+                           FloatExp& c) {
+        n = a * b - c;
+    }
+    inline static void swap(FloatExp& a, FloatExp& b) { std::swap(a, b); }
+
+    inline static void set(FloatExp& n, FloatExp& x) { n = x; }
+    inline static void set_i(FloatExp& n, int x) { n = FloatExp((double)x); }
+    inline static void set_d(FloatExp& n, double x) { n = FloatExp(x); }
+    inline static void init_set(FloatExp& n, FloatExp& x) { n = x; }
+    inline static void init_set_i(FloatExp& n, int x) { set_i(n, x); }
+    inline static void init_set_d(FloatExp& n, double x) { set_d(n, x); }
+    inline static int get_i(FloatExp& n) { return (int)(double)n; }
+    inline static double get_d(FloatExp& n) { return (double)n; }
+
+    inline static int cmp(FloatExp& a, FloatExp& b) {
+        return FloatExp::cmp(a, b);
+    }
+    inline static int cmp_i(FloatExp& a, int b) {
+        return FloatExp::cmp(a, FloatExp((double)b));
+    }
+    inline static int cmp_d(FloatExp& a, double b) {
+        return FloatExp::cmp(a, FloatExp(b));
+    }
+
+    inline static void clear(FloatExp& n) { (void)n; }
+    inline static size_t packed_size() { return sizeof(FloatExp); }
+    inline static void pack(void* out, FloatExp& n) {
+        std::memcpy(out, &n, sizeof(FloatExp));
+    }
+    inline static void unpack(FloatExp& n, const void* in) {
+        std::memcpy(&n, in, sizeof(FloatExp));
+    }
 };
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+
+#include "iteration_buffer.hpp"
+#include "thread_pool.hpp"
+
+enum class PaletteMode {
+    // iteration / limit as grey, inside is white
+    GREY,
+    // colour gradient repeating every PALETTE_PERIOD iterations
+    GRADIENT,
+    // gradient over the cumulative histogram of the escaped pixels, so every
+    // colour covers about the same area
+    HISTOGRAM
+};
+
+const char* palette_mode_name(PaletteMode mode);
+
+// maps every iteration count of buffer through a lookup table to the rgb
+// buffer pixels, in parallel on threads. smooth fractions blend between
+// neighbouring entries
+void colorize(const IterationBuffer& buffer, PaletteMode mode,
+              std::vector<unsigned char>& pixels, ThreadPool& threads);
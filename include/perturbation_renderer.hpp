@@ -0,0 +1,538 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include "bla_table.hpp"
+#include "mandelbrot_renderer.hpp"
+#include "math.hpp"
+#include "reference_orbit.hpp"
+#include "render_config.hpp"
+#include "scratch_arena.hpp"
+#include "series_approximation.hpp"
+#include "thread_manager.hpp"
+
+// pixel that could not be computed from the current reference
+struct GlitchedPixel {
+    int x, y;
+    // |z|^2 when the glitch was detected. the pixel with the smallest value is
+    // closest to the glitch center and makes a good next reference
+    double mag;
+};
+
+// state shared by all perturbation section renderers of one render
+struct PerturbationContext {
+    ReferenceOrbit orbit;
+    SeriesApproximation series;
+    BLATable<double> bla;
+    BLATable<FloatExp> fe_bla;
+
+    // pixel the reference orbit was computed for
+    int ref_x, ref_y;
+
+    // pixel spacing. deltas only need double precision, but past
+    // PERTURBATION_FLOATEXP_EXP they need FloatExp to not underflow
+    double dx, dy;
+    FloatExp fe_dx, fe_dy;
+    bool floatexp = false;
+
+    std::vector<GlitchedPixel> glitched;
+    std::mutex glitched_mutex;
+
+    // with cache, the orbit is taken from it if it has this one and stored
+    // in it otherwise. an orbit cut short by progress is not stored
+    template <typename MType, MathFuncsConcept<MType> auto& M>
+    void set_reference(FractalBounds<MType>& bounds, MType& _dx, MType& _dy,
+                       int _ref_x, int _ref_y, int max_iter,
+                       ReferenceCache<MType, M>* cache,
+                       const RenderProgress& progress) {
+        ScratchFrame<MType, M> scratch;
+        MType& cx = scratch.get();
+        MType& cy = scratch.get();
+        MType& t = scratch.get();
+
+        // same pixel -> fractal mapping as _mandelbrot_section_renderer
+        M.set_i(t, _ref_x);
+        M.fma(cx, t, _dx, bounds.x_min);
+
+        M.set_i(t, bounds.i_height - _ref_y);
+        M.fma(cy, t, _dy, bounds.y_min);
+
+        if (cache && cache->take(cx, cy, _dx, _dy, max_iter, orbit)) {
+            std::cout << "reusing the reference orbit" << std::endl;
+        } else if (orbit.compute<MType, M>(cx, cy, max_iter, &progress) &&
+                   cache) {
+            cache->store(cx, cy, max_iter, orbit);
+        }
+        series.skip = 0;
+        ref_x = _ref_x;
+        ref_y = _ref_y;
+    }
+
+    template <typename D>
+    D pixel_dx() const {
+        if constexpr (std::is_same_v<D, FloatExp>) {
+            return fe_dx;
+        } else {
+            return dx;
+        }
+    }
+    template <typename D>
+    D pixel_dy() const {
+        if constexpr (std::is_same_v<D, FloatExp>) {
+            return fe_dy;
+        } else {
+            return dy;
+        }
+    }
+    template <typename D>
+    const BLATable<D>& bla_table() const {
+        if constexpr (std::is_same_v<D, FloatExp>) {
+            return fe_bla;
+        } else {
+            return bla;
+        }
+    }
+};
+
+// iterates the delta of pixel (x, y) against the reference orbit. D is the
+// delta type, double or FloatExp. returns false if the pixel glitched and has
+// to be redone with a different reference. out_mag is |z|^2 at the glitch or
+// the escape and left alone for pixels inside
+template <typename D>
+bool _perturbation_pixel_t(int iterations, PerturbationContext& ctx, int x,
+                           int y, int& out_iter, double& out_mag) {
+    const double* zx = ctx.orbit.zx.data();
+    const double* zy = ctx.orbit.zy.data();
+    int length = ctx.orbit.length;
+
+    // dc = c - c_ref, y is flipped like in the pixel -> fractal mapping
+    D dcx = D(x - ctx.ref_x) * ctx.pixel_dx<D>();
+    D dcy = D(ctx.ref_y - y) * ctx.pixel_dy<D>();
+
+    D dzx = 0.0, dzy = 0.0;
+
+    int iter = 0;
+    if constexpr (std::is_same_v<D, double>) {
+        if (ctx.series.skip > 0) {
+            std::complex<double> dz = ctx.series.evaluate({dcx, dcy});
+            double fx = zx[ctx.series.skip] + dz.real();
+            double fy = zy[ctx.series.skip] + dz.imag();
+
+            // pixels that escape before the skip are iterated from the start
+            if (fx * fx + fy * fy <= 4.0) {
+                iter = ctx.series.skip;
+                dzx = dz.real();
+                dzy = dz.imag();
+            }
+        }
+    }
+    int from = iter;
+
+    for (; iter < iterations; iter++) {
+        double fx = zx[iter] + (double)dzx;
+        double fy = zy[iter] + (double)dzy;
+        double mag = fx * fx + fy * fy;
+
+        if (mag > 4.0) {
+            out_mag = mag;
+            break;
+        }
+
+        // reference ran out or the delta dominates the reference (pauldelbrot
+        // criterion): the double delta has lost its precision
+        if (iter + 1 >= length ||
+            mag < PERTURBATION_GLITCH_TOLERANCE *
+                      (zx[iter] * zx[iter] + zy[iter] * zy[iter])) {
+            if (iter + 1 < iterations) {
+                if constexpr (RENDER_TRACE) trace_iterations += iter - from;
+                out_mag = mag;
+                return false;
+            }
+        }
+
+        // dz(n+1) = (2 * Z(n) + dz(n)) * dz(n) + dc
+        D tx = D(2.0 * zx[iter]) + dzx;
+        D ty = D(2.0 * zy[iter]) + dzy;
+        D ndzx = tx * dzx - ty * dzy + dcx;
+        D ndzy = tx * dzy + ty * dzx + dcy;
+
+        dzx = ndzx;
+        dzy = ndzy;
+    }
+
+    if constexpr (RENDER_TRACE) trace_iterations += iter - from;
+    out_iter = iter;
+    return true;
+}
+
+// iterates the delta of pixel (x, y) like _perturbation_pixel_t, but skips as
+// many iterations as the BLA table allows for the current |dz|. the delta is
+// rebased onto the start of the reference whenever the pixel orbit gets closer
+// to 0 than to the reference, so only a reference that runs out glitches
+template <typename D>
+bool _bla_pixel_t(int iterations, PerturbationContext& ctx, int x, int y,
+                  int& out_iter, double& out_mag) {
+    const double* zx = ctx.orbit.zx.data();
+    const double* zy = ctx.orbit.zy.data();
+    int length = ctx.orbit.length;
+    const BLATable<D>& bla = ctx.bla_table<D>();
+
+    D dcx = D(x - ctx.ref_x) * ctx.pixel_dx<D>();
+    D dcy = D(ctx.ref_y - y) * ctx.pixel_dy<D>();
+
+    D dzx = 0.0, dzy = 0.0;
+
+    // iteration of the pixel and of the reference, differ after a rebase
+    int iter = 0;
+    int m = 0;
+    if constexpr (std::is_same_v<D, double>) {
+        if (ctx.series.skip > 0) {
+            std::complex<double> dz = ctx.series.evaluate({dcx, dcy});
+            double fx = zx[ctx.series.skip] + dz.real();
+            double fy = zy[ctx.series.skip] + dz.imag();
+
+            if (fx * fx + fy * fy <= 4.0) {
+                iter = m = ctx.series.skip;
+                dzx = dz.real();
+                dzy = dz.imag();
+            }
+        }
+    }
+
+    // loop steps for the trace, a table step is one however far it skips
+    int64_t steps = 0;
+    while (iter < iterations) {
+        double fx = zx[m] + (double)dzx;
+        double fy = zy[m] + (double)dzy;
+        double mag = fx * fx + fy * fy;
+
+        if (mag > 4.0) {
+            out_mag = mag;
+            break;
+        }
+        if constexpr (RENDER_TRACE) steps++;
+
+        D dz2 = dzx * dzx + dzy * dzy;
+        if (D(mag) < dz2) {
+            dzx = fx;
+            dzy = fy;
+            dz2 = mag;
+            m = 0;
+        } else if (m + 1 >= length && iter + 1 < iterations) {
+            if constexpr (RENDER_TRACE) trace_iterations += steps;
+            out_mag = mag;
+            return false;
+        }
+
+        const BLAStep<D>* step = bla.lookup(m, dz2, iterations - iter);
+        if (step) {
+            // dz = A * dz + B * dc
+            D ndzx = step->ax * dzx - step->ay * dzy + step->bx * dcx -
+                     step->by * dcy;
+            D ndzy = step->ax * dzy + step->ay * dzx + step->bx * dcy +
+                     step->by * dcx;
+
+            dzx = ndzx;
+            dzy = ndzy;
+            m += step->l;
+            iter += step->l;
+            continue;
+        }
+
+        D tx = D(2.0 * zx[m]) + dzx;
+        D ty = D(2.0 * zy[m]) + dzy;
+        D ndzx = tx * dzx - ty * dzy + dcx;
+        D ndzy = tx * dzy + ty * dzx + dcy;
+
+        dzx = ndzx;
+        dzy = ndzy;
+        m++;
+        iter++;
+    }
+
+    if constexpr (RENDER_TRACE) trace_iterations += steps;
+    out_iter = iter;
+    return true;
+}
+
+inline bool _perturbation_pixel(int iterations, PerturbationContext& ctx,
+                                int x, int y, int& out_iter, double& out_mag) {
+    if (ctx.floatexp) {
+        return _perturbation_pixel_t<FloatExp>(iterations, ctx, x, y,
+                                               out_iter, out_mag);
+    }
+    return _perturbation_pixel_t<double>(iterations, ctx, x, y, out_iter,
+                                         out_mag);
+}
+
+inline bool _bla_pixel(int iterations, PerturbationContext& ctx, int x, int y,
+                       int& out_iter, double& out_mag) {
+    if (ctx.floatexp) {
+        return _bla_pixel_t<FloatExp>(iterations, ctx, x, y, out_iter,
+                                      out_mag);
+    }
+    return _bla_pixel_t<double>(iterations, ctx, x, y, out_iter, out_mag);
+}
+
+using PerturbationPixelFunc = bool (*)(int, PerturbationContext&, int, int,
+                                       int&, double&);
+
+// returns false if pixels glitched, they are left for the glitch passes
+template <PerturbationPixelFunc pixel_func>
+bool _perturbation_section_renderer(int iterations, PerturbationContext& ctx,
+                                    int width, int start_x, int end_x,
+                                    int start_y, int end_y,
+                                    const RenderPass& pass,
+                                    IterationBuffer& out) {
+    std::vector<GlitchedPixel> glitched;
+
+    for (int y = pass.first_row(start_y); y < end_y; y += pass.step) {
+        int x, stride;
+        pass.row(y, start_x, x, stride);
+        for (; x < end_x; x += stride) {
+            int iter;
+            double mag = 0.0;
+            if (!pixel_func(iterations, ctx, x, y, iter, mag)) {
+                glitched.push_back({x, y, mag});
+                continue;
+            }
+            out.set_block(x, y, pass.step, iter, _smooth_fraction(mag),
+                          pass.block_end(end_x), pass.block_end(end_y));
+        }
+    }
+
+    if (!glitched.empty()) {
+        std::lock_guard<std::mutex> lock(ctx.glitched_mutex);
+        ctx.glitched.insert(ctx.glitched.end(), glitched.begin(),
+                            glitched.end());
+    }
+    return glitched.empty();
+}
+
+// re-renders a list of glitched pixels against the current reference
+template <PerturbationPixelFunc pixel_func>
+void _perturbation_glitch_renderer(int iterations, PerturbationContext& ctx,
+                                   int width, const GlitchedPixel* begin,
+                                   const GlitchedPixel* end,
+                                   IterationBuffer& out) {
+    std::vector<GlitchedPixel> glitched;
+
+    for (const GlitchedPixel* p = begin; p != end; p++) {
+        int iter;
+        double mag = 0.0;
+        if (!pixel_func(iterations, ctx, p->x, p->y, iter, mag)) {
+            glitched.push_back({p->x, p->y, mag});
+            continue;
+        }
+        out.set(p->x, p->y, iter, _smooth_fraction(mag));
+    }
+
+    if (!glitched.empty()) {
+        std::lock_guard<std::mutex> lock(ctx.glitched_mutex);
+        ctx.glitched.insert(ctx.glitched.end(), glitched.begin(),
+                            glitched.end());
+    }
+}
+
+// fits the series approximation for the current reference with a grid of
+// SERIES_APPROX_PROBES x SERIES_APPROX_PROBES pixels spanning the view as
+// probes
+inline void _fit_series_approximation(PerturbationContext& ctx, int width,
+                                      int height, int max_iter,
+                                      const RenderProgress& progress) {
+    std::vector<std::complex<double>> probes;
+    for (int j = 0; j < SERIES_APPROX_PROBES; j++) {
+        for (int i = 0; i < SERIES_APPROX_PROBES; i++) {
+            int px = i * (width - 1) / (SERIES_APPROX_PROBES - 1);
+            int py = j * (height - 1) / (SERIES_APPROX_PROBES - 1);
+            if (px == ctx.ref_x && py == ctx.ref_y) continue;
+            probes.push_back({(px - ctx.ref_x) * ctx.dx,
+                              (ctx.ref_y - py) * ctx.dy});
+        }
+    }
+
+    ctx.series.compute(ctx.orbit, probes, max_iter, &progress);
+    if (progress.is_cancelled()) return;
+
+    std::cout << "series approximation skips " << ctx.series.skip
+              << " iterations" << std::endl;
+}
+
+// renders bounds with one high precision reference orbit at the view center
+// and double precision deltas for every pixel. glitched pixels are redone with
+// new references picked from the glitches, anything left after
+// PERTURBATION_MAX_GLITCH_PASSES falls back to the full precision kernel.
+// with series_approximation every pixel of the first pass starts at the
+// iteration picked by SeriesApproximation::compute. pixel_func is
+// _perturbation_pixel or _bla_pixel, for the latter a BLA table is built for
+// every reference. once the pixel spacing leaves the double range the deltas
+// and the BLA table switch to FloatExp. exposed works as in _render_fractal.
+// the first reference, at the center, comes from and goes to references if
+// given
+template <typename MType, MathFuncsConcept<MType> auto& M,
+          PerturbationPixelFunc pixel_func>
+void _render_perturbation(FractalBounds<MType>& bounds, int res,
+                          ThreadPool& threads, RenderProgress& progress,
+                          int max_iter, bool series_approximation,
+                          IterationBuffer& out,
+                          const std::vector<ComputeSection>* exposed = nullptr,
+                          ReferenceCache<MType, M>* references = nullptr) {
+    std::cout << "perturbation renderer called" << std::endl;
+
+    ScratchFrame<MType, M> scratch;
+    MType& dx = scratch.get();
+    MType& dy = scratch.get();
+    // dx = (x_max - x_min) / width
+    M.sub(dx, bounds.x_max, bounds.x_min);
+    M.div(dx, dx, bounds.width);
+    // dy = (y_max - y_min) / height
+    M.sub(dy, bounds.y_max, bounds.y_min);
+    M.div(dy, dy, bounds.height);
+
+    // perturbation renders are not resumed
+    out.resume.clear();
+    if (!exposed) {
+        out.resize(bounds.i_width, bounds.i_height, SMOOTH_ITERATIONS);
+        out.iterations = max_iter;
+    }
+
+    bounds.template update_rendered<M>();
+
+    PerturbationContext ctx;
+    ctx.dx = M.get_d(dx);
+    ctx.dy = M.get_d(dy);
+    ctx.fe_dx = to_floatexp(dx);
+    ctx.fe_dy = to_floatexp(dy);
+    ctx.floatexp =
+        std::min(ctx.fe_dx.e, ctx.fe_dy.e) < PERTURBATION_FLOATEXP_EXP;
+
+    if (ctx.floatexp) {
+        std::cout << "pixel spacing below double range, using floatexp deltas"
+                  << std::endl;
+    }
+
+    auto set_reference = [&](int ref_x, int ref_y,
+                             ReferenceCache<MType, M>* cache) {
+        ctx.set_reference<MType, M>(bounds, dx, dy, ref_x, ref_y, max_iter,
+                                    cache, progress);
+
+        if constexpr (pixel_func == _bla_pixel) {
+            // largest |dc| is at one of the corners
+            FloatExp c_max_x =
+                FloatExp(std::max(ref_x, bounds.i_width - ref_x)) *
+                abs(ctx.fe_dx);
+            FloatExp c_max_y =
+                FloatExp(std::max(ref_y, bounds.i_height - ref_y)) *
+                abs(ctx.fe_dy);
+            FloatExp c_max = _bla_abs(c_max_x, c_max_y);
+
+            if (ctx.floatexp) {
+                ctx.fe_bla.build(ctx.orbit, c_max, threads, &progress);
+            } else {
+                ctx.bla.build(ctx.orbit, (double)c_max, threads, &progress);
+            }
+        }
+    };
+
+    set_reference(bounds.i_width / 2, bounds.i_height / 2, references);
+    if (progress.is_cancelled()) return;
+
+    // the series coefficients grow like 1 / dc^k and overflow doubles long
+    // before floatexp deltas are needed
+    if (series_approximation && !ctx.floatexp) {
+        _fit_series_approximation(ctx, bounds.i_width, bounds.i_height,
+                                  max_iter, progress);
+    }
+
+    ComputePool<MType, M> pool;
+    if (exposed) {
+        pool.sections = *exposed;
+    } else {
+        pool.create_pool_section_bounds(bounds, 10, 10);
+    }
+    progress.pixels_total = _sections_area(pool.sections);
+    if (progress.on_section) progress.track_sections(pool.sections);
+
+    // the glitch passes after the sections are not traced
+    RenderTrace trace("perturbation");
+
+    // coarse passes first, each one is shown as soon as it is done.
+    // glitches of all passes are fixed at the end
+    for (RenderPass pass : _render_passes(res)) {
+        pass.clip = exposed != nullptr;
+        if (progress.is_cancelled()) return;
+
+        threads.run(
+            pool.sections,
+            [&, max_iter](const ComputeSection& section) {
+                if (progress.is_cancelled()) return;
+
+                int64_t start = trace.now();
+                bool final = _perturbation_section_renderer<pixel_func>(
+                    max_iter, ctx, bounds.i_width, section.start_x,
+                    section.end_x, section.start_y, section.end_y, pass,
+                    out);
+                trace.section(start, section, pass, out, max_iter);
+                progress.add_section(section, pass, final);
+            },
+            THREAD_POOL_SPLIT_ROWS * pass.step);
+
+        progress.pass_done();
+    }
+
+    trace.finish(threads.size());
+
+    for (int pass = 0; pass < PERTURBATION_MAX_GLITCH_PASSES &&
+                       !ctx.glitched.empty() && !progress.is_cancelled();
+         pass++) {
+        std::vector<GlitchedPixel> glitched;
+        glitched.swap(ctx.glitched);
+
+        const GlitchedPixel& ref = *std::min_element(
+            glitched.begin(), glitched.end(),
+            [](const GlitchedPixel& a, const GlitchedPixel& b) {
+                return a.mag < b.mag;
+            });
+
+        std::cout << "glitch pass " << pass << ": " << glitched.size()
+                  << " pixels, new reference at " << ref.x << ", " << ref.y
+                  << std::endl;
+
+        set_reference(ref.x, ref.y, nullptr);
+
+        threads.parallel_chunks(glitched.size(), 1024, [&](int begin, int end) {
+            if (progress.is_cancelled()) return;
+            _perturbation_glitch_renderer<pixel_func>(
+                max_iter, ctx, bounds.i_width, glitched.data() + begin,
+                glitched.data() + end, out);
+        });
+    }
+
+    if (progress.is_cancelled()) return;
+
+    if (!ctx.glitched.empty()) {
+        std::cout << ctx.glitched.size()
+                  << " pixels left glitched, using full precision" << std::endl;
+
+        threads.parallel_chunks(
+            ctx.glitched.size(), 16, [&](int begin, int end) {
+                if (progress.is_cancelled()) return;
+                for (int i = begin; i < end; i++) {
+                    GlitchedPixel& p = ctx.glitched[i];
+                    _mandelbrot_section_renderer<MType, M>(
+                        max_iter, bounds.x_min, bounds.y_min, bounds.i_width,
+                        bounds.i_height, p.x, p.x + 1, p.y, p.y + 1, dx, dy,
+                        RenderPass{}, out);
+                }
+            });
+    }
+
+    // the sections that glitched are final now
+    if (progress.on_section) progress.release_sections();
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include "math.hpp"
+#include "render_config.hpp"
+#include "scratch_arena.hpp"
+#include "thread_manager.hpp"
+
+// orbit of a single reference point, computed at full precision and rounded
+// to doubles. every pixel is then iterated as a small delta from this orbit
+struct ReferenceOrbit {
+    std::vector<double> zx, zy;
+
+    // number of stored orbit points. if length < max_iter the reference
+    // escaped at iteration length - 1
+    int length = 0;
+
+    // stops early once progress is cancelled, false then and the orbit is
+    // cut short
+    template <typename MType, MathFuncsConcept<MType> auto& M>
+    bool compute(MType& cx, MType& cy, int max_iter,
+                 const RenderProgress* progress = nullptr) {
+        ScratchFrame<MType, M> scratch;
+        MType& _zx = scratch.get();
+        MType& _zy = scratch.get();
+        MType& zx2 = scratch.get();
+        MType& zy2 = scratch.get();
+        MType& nzx = scratch.get();
+        MType& nzy = scratch.get();
+        MType& tmp = scratch.get();
+        M.set_i(_zx, 0);
+        M.set_i(_zy, 0);
+
+        zx.clear();
+        zy.clear();
+        zx.reserve(max_iter);
+        zy.reserve(max_iter);
+
+        bool cancelled = false;
+        for (int n = 0; n < max_iter; n++) {
+            if (progress && progress->is_cancelled()) {
+                cancelled = true;
+                break;
+            }
+
+            zx.push_back(M.get_d(_zx));
+            zy.push_back(M.get_d(_zy));
+
+            M.sqr(zx2, _zx);
+            M.sqr(zy2, _zy);
+
+            M.add(tmp, zx2, zy2);
+            if (M.cmp_i(tmp, 4) > 0) {
+                break;
+            }
+
+            M.sub(nzx, zx2, zy2);
+            M.add(nzx, nzx, cx);
+            M.mul_2si(tmp, _zx, 1);
+            M.fma(nzy, tmp, _zy, cy);
+
+            M.swap(_zx, nzx);
+            M.swap(_zy, nzy);
+        }
+
+        length = zx.size();
+        return !cancelled;
+    }
+};
+
+// center orbit of an earlier render, for the next render around the same
+// point. it is taken while the new reference point is within
+// REFERENCE_REUSE_TOLERANCE pixel spacings of the old one, the numbers are no
+// more precise than they were and the iteration limit is the same. zooming
+// in place and zoom sequences only compute the orbit once per precision
+template <typename MType, MathFuncsConcept<MType> auto& M>
+struct ReferenceCache {
+    bool valid = false;
+    ReferenceOrbit orbit;
+    MType cx, cy;
+    // M.packed_size() of cx and cy, grows with the mpfr precision
+    size_t size = 0;
+    int max_iter = 0;
+
+    ReferenceCache() {
+        M.init(cx);
+        M.init(cy);
+    }
+    ~ReferenceCache() {
+        M.clear(cx);
+        M.clear(cy);
+    }
+
+    ReferenceCache(const ReferenceCache&) = delete;
+    ReferenceCache& operator=(const ReferenceCache&) = delete;
+
+    // copies the orbit of _cx + _cy i into out if there is one
+    bool take(MType& _cx, MType& _cy, MType& dx, MType& dy, int _max_iter,
+              ReferenceOrbit& out) {
+        if (!valid || _max_iter != max_iter || M.packed_size() > size) {
+            return false;
+        }
+
+        ScratchFrame<MType, M> scratch;
+        MType& t = scratch.get();
+
+        // offsets in pixel spacings
+        M.sub(t, _cx, cx);
+        M.div(t, t, dx);
+        if (std::abs(M.get_d(t)) > REFERENCE_REUSE_TOLERANCE) return false;
+        M.sub(t, _cy, cy);
+        M.div(t, t, dy);
+        if (std::abs(M.get_d(t)) > REFERENCE_REUSE_TOLERANCE) return false;
+
+        out = orbit;
+        return true;
+    }
+
+    void store(MType& _cx, MType& _cy, int _max_iter,
+               const ReferenceOrbit& _orbit) {
+        // at the current precision
+        M.clear(cx);
+        M.clear(cy);
+        M.init_set(cx, _cx);
+        M.init_set(cy, _cy);
+        size = M.packed_size();
+        max_iter = _max_iter;
+        orbit = _orbit;
+        valid = true;
+    }
+};
@@ -1,5 +1,111 @@
 #pragma once
 
+#include <cstddef>
+
 constexpr int START_MPFR_PREC = 128;
+// mpfr precision follows the view: bits between the largest coordinate and
+// the pixel spacing, plus MPFR_PREC_GUARD_BITS, rounded up to whole limbs
+constexpr int MPFR_MIN_PREC = 64;
+constexpr int MPFR_PREC_GUARD_BITS = 32;
 constexpr int START_WINDOW_X = 3000;
 constexpr int START_WINDOW_Y = 2000;
+// width of the view on the real axis at zoom level 1, that of the start view
+constexpr double ZOOM_1_VIEW_WIDTH = 3.0;
+
+// renders from the window start with every 4th pixel in both directions, then
+// every 2nd, then all of them
+constexpr int PROGRESSIVE_START_STEP = 4;
+
+// limbs of MathType::FIXED_POINT, one integer limb and 64 fraction bits per
+// remaining limb. 3 matches the fraction bits of START_MPFR_PREC
+constexpr int FIXED_POINT_LIMBS = 3;
+
+// automatic engine choice: the cheapest engine whose mantissa still covers the
+// bits a view needs, with room for the rounding errors of the iteration.
+// deeper views use MathType::BLA
+constexpr int AUTO_DOUBLE_BITS = 44;
+constexpr int AUTO_DOUBLE_DOUBLE_BITS = 96;
+constexpr int AUTO_FIXED_POINT_BITS = 64 * (FIXED_POINT_LIMBS - 1) - 12;
+
+// temporaries each thread keeps initialized per math type
+constexpr int SCRATCH_ARENA_SLOTS = 32;
+
+// route gmp/mpfr allocations through thread local pools instead of malloc.
+// blocks up to GMP_POOL_MAX_BLOCK bytes are pooled, pools grow by chunks of at
+// least GMP_POOL_CHUNK bytes or GMP_POOL_CHUNK_BLOCKS mpfr_t limb buffers
+constexpr bool GMP_POOL_ALLOCATOR = false;
+constexpr size_t GMP_POOL_MAX_BLOCK = 64 * 1024;
+constexpr size_t GMP_POOL_CHUNK = 256 * 1024;
+constexpr size_t GMP_POOL_CHUNK_BLOCKS = 256;
+
+// render sections are computed this many rows at a time, a section still
+// running while a worker is idle gives away half of its remaining rows
+constexpr int THREAD_POOL_SPLIT_ROWS = 8;
+
+// record every section a render thread computes, with its time, iterations and
+// escapes, into a ring of the last TRACE_RING_EVENTS per thread, and print a
+// summary after every render. off, the recording compiles to nothing
+constexpr bool RENDER_TRACE = false;
+constexpr size_t TRACE_RING_EVENTS = 1 << 16;
+
+// interior detection in the generic kernel: main cardioid and period 2 bulb
+// test, and periodicity checking with a tolerance of PERIODICITY_TOLERANCE
+// pixel spacings
+constexpr bool INTERIOR_DETECTION = true;
+constexpr double PERIODICITY_TOLERANCE = 1e-3;
+
+// keep the fraction of an iteration left at the escape for continuous
+// colouring
+constexpr bool SMOOTH_ITERATIONS = true;
+// iterations per cycle of the gradient palette
+constexpr int PALETTE_PERIOD = 64;
+
+// keep z of the pixels that reach the iteration limit, so raising the limit
+// of an unchanged view only continues those
+constexpr bool RESUMABLE_ITERATION = true;
+
+// a view within this many pixels of a whole pixel translation of the last
+// render is snapped onto its pixel grid, and only the pixels shifted in are
+// rendered
+constexpr double PAN_SNAP_TOLERANCE = 1e-2;
+
+// zoom factor of one zoom step in the window
+constexpr double ZOOM_STEP = 1.5;
+
+// finished renders are kept as TILE_SIZE x TILE_SIZE pixel tiles in an lru
+// cache of up to TILE_CACHE_BYTES, frames are assembled from the cached tiles
+// and only the missing ones are rendered. a view gets tiles if its pixel
+// spacing is within TILE_SCALE_TOLERANCE of a whole number of zoom steps from
+// the start view, it is then snapped onto the pixel grid of that zoom step
+constexpr bool TILE_CACHE = true;
+constexpr int TILE_SIZE = 64;
+constexpr size_t TILE_CACHE_BYTES = (size_t)512 << 20;
+constexpr double TILE_SCALE_TOLERANCE = 1e-6;
+
+// mariani-silver: rectangles up to this many pixels of the pass grid in
+// either direction are computed without subdividing further
+constexpr int SUBDIVISION_MIN_SIZE = 6;
+// while a render thread is idle, rectangles of at least this many grid cells
+// hand one half to it instead of recursing into both
+constexpr int SUBDIVISION_SPAWN_CELLS = 32 * 32;
+
+// perturbation: |z|^2 < tolerance * |Z|^2 marks a pixel as glitched
+constexpr double PERTURBATION_GLITCH_TOLERANCE = 1e-6;
+constexpr int PERTURBATION_MAX_GLITCH_PASSES = 16;
+// pixel spacings below 2^PERTURBATION_FLOATEXP_EXP iterate the deltas as
+// FloatExp, close to where doubles start to underflow
+constexpr int PERTURBATION_FLOATEXP_EXP = -960;
+// a later render around the same center takes the reference orbit of the last
+// one while the centers are within this many pixel spacings of each other
+constexpr double REFERENCE_REUSE_TOLERANCE = 1e-3;
+
+// series approximation: number of polynomial terms, probe grid size and the
+// relative error a probe may have before the skip stops growing
+constexpr int SERIES_APPROX_TERMS = 6;
+constexpr int SERIES_APPROX_PROBES = 9;
+constexpr double SERIES_APPROX_TOLERANCE = 1e-9;
+
+// bla: single steps are valid while |dz| < epsilon * |Z|. tables are built in
+// chunks of BLA_BUILD_CHUNK steps per thread
+constexpr double BLA_EPSILON = 0x1p-32;
+constexpr int BLA_BUILD_CHUNK = 4096;
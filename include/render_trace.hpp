@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "iteration_buffer.hpp"
+#include "mandelbrot_renderer.hpp"
+#include "render_config.hpp"
+#include "thread_pool.hpp"
+
+// one section computed by a render thread. pixels and escaped count the
+// pixels the pass owns in the section, pixels a kernel filled in without
+// iterating (subdivision, interior checks) count with what they were given.
+// iterations are the ones the kernels ran for the section, see
+// trace_iterations
+struct TraceEvent {
+    int64_t start_ns, end_ns;
+    int render;
+    int step;
+    ComputeSection section;
+    int pixels;
+    int escaped;
+    int64_t iterations;
+};
+
+// events of one thread, the oldest are overwritten once TRACE_RING_EVENTS are
+// kept. only its thread writes, the lock is for readers
+struct TraceRing {
+    int thread;
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+    size_t next = 0;
+
+    void push(const TraceEvent& event);
+    // events oldest first
+    std::vector<TraceEvent> snapshot();
+};
+
+struct RenderTraceSummary {
+    int render;
+    double ms;
+    int sections;
+    long pixels;
+    long escaped;
+    int64_t iterations;
+    // time the threads spent in sections, and the most one of them did
+    double busy_ms;
+    double max_busy_ms;
+    // thread time not spent in sections
+    double idle_ms;
+    // max_busy_ms over the mean busy time, 1 is perfectly balanced
+    double imbalance;
+};
+
+// ns since the first call
+int64_t trace_now_ns();
+// ring of the calling thread, created on its first call
+TraceRing& trace_ring();
+
+// trace of one render, sections are recorded while it runs. every method is
+// empty without RENDER_TRACE
+struct RenderTrace {
+    const char* name;
+    int id = 0;
+    int64_t start_ns = 0;
+
+    explicit RenderTrace(const char* _name) : name(_name) {
+        if constexpr (RENDER_TRACE) _begin();
+    }
+
+    // start time for section, also starts counting its iterations
+    int64_t now() const {
+        if constexpr (RENDER_TRACE) {
+            trace_iterations = 0;
+            return trace_now_ns();
+        }
+        return 0;
+    }
+
+    // section of pass was computed into out since start
+    void section(int64_t start, const ComputeSection& section,
+                 const RenderPass& pass, const IterationBuffer& out,
+                 int max_iter) {
+        if constexpr (RENDER_TRACE) {
+            _section(start, section, pass, out, max_iter);
+        }
+    }
+
+    // summary of the sections recorded since the start, printed. threads is
+    // the size of the pool that ran them
+    void finish(int threads) {
+        if constexpr (RENDER_TRACE) _finish(threads);
+    }
+
+    void _begin();
+    void _section(int64_t start, const ComputeSection& section,
+                  const RenderPass& pass, const IterationBuffer& out,
+                  int max_iter);
+    void _finish(int threads);
+};
+
+// summaries of the finished renders still in the rings, oldest first
+std::vector<RenderTraceSummary> trace_summaries();
+// chrome trace event json (chrome://tracing, perfetto) of everything still in
+// the rings: a span per render and one per section on the thread that
+// computed it. false if the file cannot be written
+bool write_chrome_trace(const std::string& path);
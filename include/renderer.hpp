@@ -1,26 +1,55 @@
+#include <atomic>
+#include <condition_variable>
 #include <format>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "iteration_buffer.hpp"
 #include "math.hpp"
+#include "palette.hpp"
+#include "reference_orbit.hpp"
+#include "scratch_arena.hpp"
+#include "thread_manager.hpp"
+#include "thread_pool.hpp"
+#include "tile_cache.hpp"
+
+template <typename MType, MathFuncsConcept<MType> auto& M>
+void map(MType& out, MType& x, MType& min_1, MType& max_1, MType& min_2,
+         MType& max_2) {
+    ScratchFrame<MType, M> scratch;
+    MType& scaled_x = scratch.get();
+    MType& range_1 = scratch.get();
+    MType& range_2 = scratch.get();
+
+    M.sub(scaled_x, x, min_1);
+    M.sub(range_2, max_2, min_2);
+    M.sub(range_1, max_1, min_1);
+
+    // dividing first keeps the intermediate near 1, the product of two small
+    // ranges would drop below the resolution of fixed point types
+    M.div(scaled_x, scaled_x, range_1);
+    M.fma(out, scaled_x, range_2, min_2);
+}
 
 template <typename MType, MathFuncsConcept<MType> auto& M>
 void arb_normalize_bounds(FractalBounds<MType>& bounds, MType* offset_x_out,
                           MType* offset_y_out) {
-    MType center_x, center_y;
-    MType two;
-
-    M.init(center_x);
-    M.init(center_y);
-    M.init_set_i(two, 2);
+    ScratchFrame<MType, M> scratch;
+    MType& center_x = scratch.get();
+    MType& center_y = scratch.get();
 
     // find center of bounds
     // center = (max + min) / 2
     M.add(center_x, bounds.x_max, bounds.x_min);
-    M.div(center_x, center_x, two);
+    M.mul_2si(center_x, center_x, -1);
 
     M.add(center_y, bounds.y_max, bounds.y_min);
-    M.div(center_y, center_y, two);
+    M.mul_2si(center_y, center_y, -1);
 
     // center is the offset to apply
     if (offset_x_out) {
@@ -37,10 +66,6 @@ void arb_normalize_bounds(FractalBounds<MType>& bounds, MType* offset_x_out,
 
     M.sub(bounds.y_min, bounds.y_min, center_y);
     M.sub(bounds.y_max, bounds.y_max, center_y);
-
-    M.clear(center_x);
-    M.clear(center_y);
-    M.clear(two);
 }
 
 template <typename MType, MathFuncsConcept<MType> auto& M>
@@ -64,15 +89,17 @@ void arb_move_bound_windowed(FractalBounds<MType>& bounds, int _wx, int _wy) {
     double _nwy = (double)_wy / (double)bounds.i_height;
 
     // convert to fractal coords
-    MType nwx, nwy;
-    MType fx, fy;
-    MType zero, one;
-    M.init_set_d(nwx, _nwx);
-    M.init_set_d(nwy, _nwy);
-    M.init_set_i(zero, 0);
-    M.init_set_i(one, 1);
-    M.init(fx);
-    M.init(fy);
+    ScratchFrame<MType, M> scratch;
+    MType& nwx = scratch.get();
+    MType& nwy = scratch.get();
+    MType& fx = scratch.get();
+    MType& fy = scratch.get();
+    MType& zero = scratch.get();
+    MType& one = scratch.get();
+    M.set_d(nwx, _nwx);
+    M.set_d(nwy, _nwy);
+    M.set_i(zero, 0);
+    M.set_i(one, 1);
 
     map<MType, M>(fx, nwx, zero, one, bounds.r_x_min, bounds.r_x_max);
     map<MType, M>(fy, nwy, zero, one, bounds.r_y_min, bounds.r_y_max);
@@ -85,23 +112,16 @@ void arb_move_bound_windowed(FractalBounds<MType>& bounds, int _wx, int _wy) {
               << M.get_d(bounds.r_y_max) << "]\n";
 
     std::cout << "x: " << M.get_d(fx) << "y: " << M.get_d(fy) << std::endl;
-
-    M.clear(nwx);
-    M.clear(nwy);
-    M.clear(fx);
-    M.clear(fy);
-    M.clear(zero);
-    M.clear(one);
 }
 
+// zooms bounds by _zoom_factor around their center
 template <typename MType, MathFuncsConcept<MType> auto& M>
-void arb_bound_zoom(FractalBounds<MType>& bounds, double _zoom_factor) {
-    MType offset_x, offset_y;
-    MType zoom_factor;
-
-    M.init(offset_x);
-    M.init(offset_y);
-    M.init_set_d(zoom_factor, _zoom_factor);
+void arb_zoom_bounds(FractalBounds<MType>& bounds, double _zoom_factor) {
+    ScratchFrame<MType, M> scratch;
+    MType& offset_x = scratch.get();
+    MType& offset_y = scratch.get();
+    MType& zoom_factor = scratch.get();
+    M.set_d(zoom_factor, _zoom_factor);
 
     // normalize boubds
     arb_normalize_bounds<MType, M>(bounds, &offset_x, &offset_y);
@@ -117,34 +137,33 @@ void arb_bound_zoom(FractalBounds<MType>& bounds, double _zoom_factor) {
     arb_unnormalize_bounds<MType, M>(bounds, offset_x, offset_y);
 
     bounds.template update_aux<M>();
+}
+
+template <typename MType, MathFuncsConcept<MType> auto& M>
+void arb_bound_zoom(FractalBounds<MType>& bounds, double _zoom_factor) {
+    arb_zoom_bounds<MType, M>(bounds, _zoom_factor);
 
     // return;
 
     std::cout << std::format("x_min: {}, x_max: {}, y_min: {}, 66y_max: {}\n",
                              bounds.d_x_min, bounds.d_x_max, bounds.d_y_min,
                              bounds.d_y_max);
-
-    M.clear(offset_x);
-    M.clear(offset_y);
-    M.clear(zoom_factor);
 }
 
 template <typename MType, MathFuncsConcept<MType> auto& M>
 inline void get_windowed_bound_rect(FractalBounds<MType>& bounds, double& x1,
                                     double& y1, double& x2, double& y2) {
-    MType neg_one;
-    MType one;
-
-    MType w_x_min, w_x_max;
-    MType w_y_min, w_y_max;
+    ScratchFrame<MType, M> scratch;
+    MType& neg_one = scratch.get();
+    MType& one = scratch.get();
 
-    M.init(w_x_min);
-    M.init(w_x_max);
-    M.init(w_y_min);
-    M.init(w_y_max);
+    MType& w_x_min = scratch.get();
+    MType& w_x_max = scratch.get();
+    MType& w_y_min = scratch.get();
+    MType& w_y_max = scratch.get();
 
-    M.init_set_i(neg_one, -1);
-    M.init_set_i(one, 1);
+    M.set_i(neg_one, -1);
+    M.set_i(one, 1);
 
     map<MType, M>(w_x_min, bounds.x_min, bounds.r_x_min, bounds.r_x_max,
                   neg_one, one);
@@ -160,36 +179,170 @@ inline void get_windowed_bound_rect(FractalBounds<MType>& bounds, double& x1,
     y1 = M.get_d(w_y_min);
     x2 = M.get_d(w_x_max);
     y2 = M.get_d(w_y_max);
+}
+
+// whole pixel offset kx, ky of bounds from last at the same scale. bounds is
+// snapped onto the pixel grid of last, so pixel x, y of bounds is pixel
+// x + kx, y - ky of last. false if there is no such offset, it is 0 or the
+// views do not overlap
+template <typename MType, MathFuncsConcept<MType> auto& M>
+bool arb_pixel_offset(FractalBounds<MType>& bounds, FractalBounds<MType>& last,
+                      int& kx, int& ky) {
+    if (bounds.i_width != last.i_width || bounds.i_height != last.i_height) {
+        return false;
+    }
+
+    ScratchFrame<MType, M> scratch;
+    MType& dx = scratch.get();
+    MType& dy = scratch.get();
+    MType& tmp = scratch.get();
+    _pixel_spacing<MType, M>(last, dx, dy);
+
+    // offset of one bound in pixels
+    auto offset = [&](MType& a, MType& b, MType& spacing) {
+        M.sub(tmp, a, b);
+        M.div(tmp, tmp, spacing);
+        return M.get_d(tmp);
+    };
+    double ox_min = offset(bounds.x_min, last.x_min, dx);
+    double ox_max = offset(bounds.x_max, last.x_max, dx);
+    double oy_min = offset(bounds.y_min, last.y_min, dy);
+    double oy_max = offset(bounds.y_max, last.y_max, dy);
+
+    kx = (int)std::lround(ox_min);
+    ky = (int)std::lround(oy_min);
+
+    // both bounds of an axis move by the same whole number of pixels
+    for (double o : {ox_min - kx, ox_max - kx, oy_min - ky, oy_max - ky}) {
+        if (!(std::abs(o) <= PAN_SNAP_TOLERANCE)) return false;
+    }
+    // an unchanged view is not a pan, there would be nothing to render
+    if (kx == 0 && ky == 0) return false;
+    if (std::abs(kx) >= bounds.i_width || std::abs(ky) >= bounds.i_height) {
+        return false;
+    }
+
+    M.set_i(tmp, kx);
+    M.fma(bounds.x_min, tmp, dx, last.x_min);
+    M.fma(bounds.x_max, tmp, dx, last.x_max);
+    M.set_i(tmp, ky);
+    M.fma(bounds.y_min, tmp, dy, last.y_min);
+    M.fma(bounds.y_max, tmp, dy, last.y_max);
+    bounds.template update_aux<M>();
+    return true;
+}
+
+// sets out to value, rounded to what MType holds. value is summed up in
+// chunks of double precision, enough for the widest math type
+template <typename MType, MathFuncsConcept<MType> auto& M>
+void arb_set_mpfr(MType& out, mpfr_t value) {
+    ScratchFrame<MType, M> scratch;
+    MType& chunk = scratch.get();
+
+    mpfr_t rest;
+    mpfr_init2(rest, mpfr_get_prec(value));
+    mpfr_set(rest, value, MPFR_RNDN);
+
+    M.set_i(out, 0);
+    for (int i = 0; i < 4 && !mpfr_zero_p(rest); i++) {
+        double d = mpfr_get_d(rest, MPFR_RNDN);
+        M.set_d(chunk, d);
+        M.add(out, out, chunk);
+        mpfr_sub_d(rest, rest, d, MPFR_RNDN);
+    }
+    mpfr_clear(rest);
+}
 
-    M.clear(one);
-    M.clear(neg_one);
-    M.clear(w_x_min);
-    M.clear(w_x_max);
-    M.clear(w_y_min);
-    M.clear(w_y_max);
+template <typename MType, MathFuncsConcept<MType> auto& M>
+void arb_set_bounds_mpfr(FractalBounds<MType>& bounds,
+                         FractalBounds<mpfr_t>& source) {
+    arb_set_mpfr<MType, M>(bounds.x_min, source.x_min);
+    arb_set_mpfr<MType, M>(bounds.x_max, source.x_max);
+    arb_set_mpfr<MType, M>(bounds.y_min, source.y_min);
+    arb_set_mpfr<MType, M>(bounds.y_max, source.y_max);
+    bounds.template update_aux<M>();
 }
 
+struct RenderJob;
+
 struct Renderer {
+    // rgb colours of iteration_buffer, rebuilt by recolor
     std::vector<unsigned char> pixels;
-    MathType type;
+    IterationBuffer iteration_buffer;
+    std::atomic<PaletteMode> palette = PaletteMode::GREY;
+    // the ui and the render thread both recolor
+    std::mutex recolor_mutex;
+
+    MathType type = MathType::DOUBLE;
+
+    // pick type from the zoom level on every zoom and render
+    bool auto_math_type = true;
 
     size_t iterations = 64;
 
+    // skip the shared leading iterations in MathType::PERTURBATION
+    bool series_approximation = true;
+    // mariani-silver subdivision for the mpfr, double-double and fixed point
+    // kernels
+    bool subdivision = true;
+    // snap views onto tile grids and assemble them from cached tiles, see
+    // TILE_CACHE
+    bool tiling = true;
+    // pre-render the tiles of the likely next views while idle, see speculate
+    bool speculation = true;
+
     FractalBounds<mpfr_t> mpfr_bounds;
     FractalBounds<double> double_bounds;
+    FractalBounds<DoubleDouble> dd_bounds;
+    FractalBounds<FixedPoint<FIXED_POINT_LIMBS>> fp_bounds;
 
     mpfr_t zoom_level;
 
+    // pixel spacing of zoom step 0 of the tile grid, that of the start view
+    mpfr_t tile_base;
+    // tiles of finished renders, dropped when the start view changes
+    TileCache tiles;
+
+    // render threads, kept parked between renders
+    ThreadPool threads;
+
+    // job of the last render_async and the thread running it. every
+    // job_thread waits for the one before it, so only one job writes to
+    // iteration_buffer at a time
+    std::shared_ptr<RenderJob> job;
+    std::thread job_thread;
+    // views job_thread pre-renders once job is done, cancelled with it
+    std::vector<std::shared_ptr<RenderJob>> speculative_jobs;
+    // pixels of the speculative jobs, only used by job_thread
+    IterationBuffer speculative_buffer;
+
     constexpr static MPFRMathFuncs mpfr_math_funcs{};
     constexpr static DoubleMathFuncs double_math_funcs{};
+    constexpr static DoubleDoubleMathFuncs dd_math_funcs{};
+    constexpr static FixedPointMathFuncs<FIXED_POINT_LIMBS> fp_math_funcs{};
+
+    // center orbit of the last perturbation or bla render, only used by
+    // job_thread
+    ReferenceCache<mpfr_t, mpfr_math_funcs> references;
 
     void init_bounds();
     void set_window_size_i(int width, int height);
     void set_fractal_bounds_d(double x_min, double x_max, double y_min,
                               double y_max);
-
+    // tile_base from the current view
+    void _update_tile_base();
+    // centers the view on center_x + center_y i, zoom times magnified from
+    // a view ZOOM_1_VIEW_WIDTH wide. the decimal strings are parsed at the
+    // precision the zoom needs. false if one of them does not parse
+    bool set_view(const std::string& center_x, const std::string& center_y,
+                  const std::string& zoom);
+
+    // both change mpfr_bounds and derive the other bounds from it, which
+    // would lose the view in their own arithmetic past their precision
     void bound_zoom(double zoom_factor);
     void bound_move(int wx, int wy);
+    // double_bounds, dd_bounds and fp_bounds from mpfr_bounds
+    void _sync_bounds();
     void window_get_bounds(double& out_x_min, double& out_x_max,
                            double& out_y_min, double& out_y_max);
 
@@ -197,7 +350,132 @@ struct Renderer {
     void clear_pixels();
 
     void set_math_type(MathType type);
+
+    // colours iteration_buffer into pixels with the current palette
+    void recolor();
+    // recolors on the job thread, right after the pool is free. a running job
+    // recolors after its next pass instead
+    void set_palette(PaletteMode mode);
+
+    int required_bits(FractalBounds<mpfr_t>& bounds);
+    MathType pick_math_type(int bits);
+    // the precision of the ui thread, jobs take it on when they are created
+    void update_precision();
+    // makes prec the mpfr precision and raises mpfr_bounds to it if they are
+    // stored at less, never lower. running jobs keep theirs
+    void _set_precision(mpfr_prec_t prec);
+
+    // starts rendering a snapshot of the current view in the background.
+    // cancels the previous job, the new one starts once it stopped. the
+    // pixels of the previous job are only reused if it had finished by the
+    // time of the call. res is the pixel step of
+    // the first progressive pass, 1 renders at full resolution right away.
+    // if only the iteration limit went up since the last finished job, the
+    // pixels it left at its limit go on instead. if the view only moved by
+    // whole pixels, the kept pixels are shifted instead of rendered. with
+    // TILE_CACHE, other views are assembled from cached tiles where possible
+    std::shared_ptr<RenderJob> render_async(int res, int n_threads);
+    // pre-renders the missing tiles of the current view and of one zoom step
+    // in and out of it in the background. the last job is cancelled first,
+    // render_async and cancel_render stop the pre-rendering at once. neither
+    // waits for the previous job
+    void speculate();
+    // stops the running job and pre-rendering without waiting for them
+    void cancel_render();
+    // replaces job_thread with a thread running run after the old one,
+    // which has to be cancelled already
+    void _start_job_thread(std::function<void()> run);
+    // render_async and wait for the job
     void render_mandelbrot(int res, int n_threads);
+    void _render_job(RenderJob& job);
+    void _render_job_full(RenderJob& job);
+    // renders the sections of job with its engine into out, all of it
+    // without exposed
+    void _render_sections(RenderJob& job, IterationBuffer& out,
+                          const std::vector<ComputeSection>* exposed);
+    // raises the iteration limit of the last job to that of job
+    void _resume_job(RenderJob& job);
+    // whether the current view is the one last rendered
+    bool _same_view(RenderJob& last);
+    // whether the current view is the last one moved by whole pixels, see
+    // arb_pixel_offset
+    bool _pan_offset(RenderJob& last, int& kx, int& ky);
+    // snaps bounds onto the pixel grid of its zoom step and sets grid to the
+    // tiles covering it. false if the view is between zoom steps
+    bool _snap_tile_grid(FractalBounds<mpfr_t>& bounds, TileGrid& grid);
+    // pastes the cached tiles of job into iteration_buffer and sets exposed
+    // to the rest of the view. false if no tile was cached
+    bool _assemble_tiles(RenderJob& job, std::vector<ComputeSection>& exposed);
+    // adds the tiles of the finished job that are not cached yet
+    void _store_tiles(RenderJob& job);
+    // snapshots of the current view zoomed by one step in and out, and with
+    // current of the view itself, snapped onto their tile grids
+    std::vector<std::shared_ptr<RenderJob>> _speculative_jobs(bool current);
+    // renders the tiles of jobs missing from the cache, one job after the
+    // other until one is cancelled
+    void _speculate(const std::vector<std::shared_ptr<RenderJob>>& jobs);
 
     Renderer();
+    ~Renderer();
+};
+
+// everything a render reads, copied when the job starts so the view can change
+// while it runs. the handle reports progress and cancels the render between
+// pieces of sections
+struct RenderJob {
+    MathType type;
+    size_t iterations;
+    bool series_approximation;
+    bool subdivision;
+    int res;
+    // mpfr precision of the view, the job thread renders at it
+    mpfr_prec_t prec;
+    // iteration limit of the finished render of the same view this job goes
+    // on from, 0 renders from scratch
+    size_t resume_from = 0;
+    // the last finished job rendered this view moved by -pan_x, pan_y pixels
+    // at the same iteration limit. only the pixels shifted in are rendered
+    bool pan = false;
+    int pan_x = 0, pan_y = 0;
+    // the view is on the pixel grid of a zoom step, its tiles are taken from
+    // and added to the tile cache
+    bool tiled = false;
+    TileGrid grid;
+
+    FractalBounds<mpfr_t> mpfr_bounds;
+    FractalBounds<double> double_bounds;
+    FractalBounds<DoubleDouble> dd_bounds;
+    FractalBounds<FixedPoint<FIXED_POINT_LIMBS>> fp_bounds;
+
+    RenderProgress progress;
+    // set when the render ran to the end without being cancelled
+    bool completed = false;
+    // wall time of the render, without the final recolor
+    double took_ms = 0.0;
+
+    std::mutex mutex;
+    std::condition_variable finished_cv;
+    bool finished = false;
+
+    RenderJob(Renderer& renderer, int _res);
+    ~RenderJob();
+
+    RenderJob(const RenderJob&) = delete;
+    RenderJob& operator=(const RenderJob&) = delete;
+
+    void cancel() { progress.cancelled = true; }
+    bool cancelled() const { return progress.is_cancelled(); }
+
+    // engine of the job and the settings that change its pixels, pixels of
+    // another job are only reused if this matches
+    int engine_key() const {
+        return (int)type | series_approximation << 8 | subdivision << 9;
+    }
+
+    // fraction of the pixels computed, 0 to 1
+    double get_progress() const;
+    bool done();
+    void wait();
+
+    void _finish();
 };
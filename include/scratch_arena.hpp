@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <stdexcept>
+
+#include "math.hpp"
+#include "render_config.hpp"
+
+// precision the temporaries of M are initialized with, 0 for types without a
+// runtime precision
+template <auto& M>
+long _math_prec() {
+    if constexpr (requires { M.prec; }) {
+        return M.prec;
+    } else {
+        return 0;
+    }
+}
+
+// per thread set of initialized temporaries, so hot paths borrow instead of
+// calling M.init / M.clear. slots are borrowed like a stack through
+// ScratchFrame
+template <typename MType, MathFuncsConcept<MType> auto& M>
+struct ScratchArena {
+    // mpfr_t is an array type, wrap it so it can live in std::array
+    struct Slot {
+        MType v;
+    };
+
+    std::array<Slot, SCRATCH_ARENA_SLOTS> slots;
+    int used = 0;
+    long prec;
+
+    ScratchArena() {
+        prec = _math_prec<M>();
+        for (Slot& slot : slots) {
+            M.init(slot.v);
+        }
+    }
+    ~ScratchArena() {
+        for (Slot& slot : slots) {
+            M.clear(slot.v);
+        }
+    }
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    // re-initializes the slots if the precision of M changed since they were
+    // initialized. only called while nothing is borrowed
+    void sync_prec() {
+        long current = _math_prec<M>();
+        if (current == prec) return;
+
+        for (Slot& slot : slots) {
+            M.clear(slot.v);
+            M.init(slot.v);
+        }
+        prec = current;
+    }
+
+    static ScratchArena& local() {
+        thread_local ScratchArena arena;
+        return arena;
+    }
+};
+
+// borrows slots from the arena of the calling thread and returns all of them
+// when it goes out of scope. values are left over from the last borrower, so
+// every slot has to be set before it is read
+template <typename MType, MathFuncsConcept<MType> auto& M>
+struct ScratchFrame {
+    ScratchArena<MType, M>& arena;
+    int start;
+
+    ScratchFrame() : arena(ScratchArena<MType, M>::local()) {
+        start = arena.used;
+        if (start == 0) arena.sync_prec();
+    }
+    ~ScratchFrame() { arena.used = start; }
+
+    ScratchFrame(const ScratchFrame&) = delete;
+    ScratchFrame& operator=(const ScratchFrame&) = delete;
+
+    MType& get() {
+        if (arena.used >= SCRATCH_ARENA_SLOTS) {
+            throw std::runtime_error("scratch arena out of slots");
+        }
+        return arena.slots[arena.used++].v;
+    }
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <complex>
+#include <vector>
+
+#include "reference_orbit.hpp"
+#include "render_config.hpp"
+#include "thread_manager.hpp"
+
+// polynomial in dc that approximates the delta orbit of every pixel:
+// dz(n) = a1(n) * dc + a2(n) * dc^2 + ...
+// the coefficients only depend on the reference orbit, so all pixels can start
+// at iteration skip instead of 0
+struct SeriesApproximation {
+    using Coeffs = std::array<std::complex<double>, SERIES_APPROX_TERMS>;
+
+    // number of iterations every pixel skips, 0 disables the approximation
+    int skip = 0;
+    Coeffs coeffs{};
+
+    static std::complex<double> evaluate(const Coeffs& a,
+                                         std::complex<double> dc) {
+        std::complex<double> dz = 0;
+        for (int k = SERIES_APPROX_TERMS - 1; k >= 0; k--) {
+            dz = (dz + a[k]) * dc;
+        }
+        return dz;
+    }
+
+    std::complex<double> evaluate(std::complex<double> dc) const {
+        return evaluate(coeffs, dc);
+    }
+
+    // advances the coefficients along the reference orbit for as long as the
+    // series agrees with the exactly iterated delta of every probe to within
+    // SERIES_APPROX_TOLERANCE. probes should span the view (corners, edges).
+    // once progress is cancelled it stops at the skip found so far
+    void compute(const ReferenceOrbit& orbit,
+                 const std::vector<std::complex<double>>& probes,
+                 int max_iter, const RenderProgress* progress = nullptr) {
+        Coeffs a{};
+        std::vector<std::complex<double>> dz(probes.size(), 0);
+
+        skip = 0;
+        coeffs = a;
+
+        int end = std::min(max_iter, orbit.length) - 1;
+        for (int n = 0; n < end; n++) {
+            if (progress && progress->is_cancelled()) break;
+
+            std::complex<double> Z(orbit.zx[n], orbit.zy[n]);
+            std::complex<double> next_Z(orbit.zx[n + 1], orbit.zy[n + 1]);
+
+            // dz(n+1) = 2 * Z(n) * dz(n) + dz(n)^2 + dc, collected by power
+            // of dc
+            Coeffs next;
+            for (int k = 0; k < SERIES_APPROX_TERMS; k++) {
+                next[k] = 2.0 * Z * a[k];
+                for (int i = 0; i < k; i++) {
+                    next[k] += a[i] * a[k - 1 - i];
+                }
+            }
+            next[0] += 1.0;
+
+            bool valid = true;
+            for (size_t p = 0; p < probes.size(); p++) {
+                dz[p] = (2.0 * Z + dz[p]) * dz[p] + probes[p];
+
+                // probes must not escape within the skipped iterations
+                if (std::norm(next_Z + dz[p]) > 4.0) {
+                    valid = false;
+                    break;
+                }
+
+                // written so nan/inf from overflowing coefficients fail too
+                double err = std::abs(evaluate(next, probes[p]) - dz[p]);
+                if (!(err <= SERIES_APPROX_TOLERANCE * std::abs(dz[p]))) {
+                    valid = false;
+                    break;
+                }
+            }
+            if (!valid) {
+                break;
+            }
+
+            a = next;
+            skip = n + 1;
+            coeffs = a;
+        }
+    }
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+
+#include "mandelbrot_renderer.hpp"
+
+// iterates count pixels of the row at cy with the real parts cx and writes
+// the iteration counts to out_iters, the last z, real and imaginary part
+// interleaved, to out_z and |z|^2 at the escape, 0 if the pixel did not
+// escape, to out_mag
+using SIMDRowKernel = void (*)(int iterations, const double* cx, double cy,
+                               int count, int* out_iters, double* out_z,
+                               double* out_mag);
+
+// name of the row kernel picked from CPUID at startup ("avx512", "avx2",
+// "sse2" or "scalar")
+const char* _simd_kernel_name();
+
+// section renderer for MathType::DOUBLE that iterates whole lane groups of a
+// row at once with the widest row kernel the cpu supports. same signature as
+// _mandelbrot_section_renderer<double, ...> so it plugs into _render_fractal.
+// with INTERIOR_DETECTION pixels in the main bulbs are set to the limit
+// without taking a lane
+void _simd_section_renderer(int iterations, double& x_min, double& y_min,
+                            int width, int height, int start_x, int end_x,
+                            int start_y, int end_y, double& dx, double& dy,
+                            const RenderPass& pass, IterationBuffer& out);
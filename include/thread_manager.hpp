@@ -1,112 +1,327 @@
+#pragma once
+
+#include <algorithm>
 #include <atomic>
+#include <functional>
 #include <iostream>
-#include <thread>
 #include <vector>
 
+#include "iteration_buffer.hpp"
+#include "mandelbrot_renderer.hpp"
 #include "math.hpp"
+#include "render_config.hpp"
+#include "render_trace.hpp"
+#include "scratch_arena.hpp"
+#include "thread_pool.hpp"
 
 template <typename MType, MathFuncsConcept<MType> auto& M>
 using SectionRendererFunc = void (*)(int a, MType& b, MType&, int, int, int,
                                      int, int, int, MType&, MType&,
-                                     std::vector<unsigned char>&);
+                                     const RenderPass&, IterationBuffer&);
+
+// progress of one render, shared between the render threads and whoever
+// holds the job. cancelled is checked before every piece of a section and by
+// subdivision before every rectangle, so a cancelled render stops within
+// THREAD_POOL_SPLIT_ROWS rows or one rectangle border
+struct RenderProgress {
+    std::atomic<bool> cancelled = false;
+    std::atomic<long> pixels_done = 0;
+    long pixels_total = 0;
+
+    // called by the render thread after every progressive pass that was not
+    // cancelled
+    std::function<void()> on_pass;
+    // called by the render threads with the index of a section given to
+    // track_sections once all of its pixels are final. never after a cancel
+    std::function<void(size_t)> on_section;
+
+    struct TrackedSection {
+        ComputeSection section;
+        // pixels of the last pass not done yet
+        std::atomic<long> left = 0;
+        // has pixels that are redone after the passes, see release_sections
+        std::atomic<bool> held = false;
+    };
+    std::vector<TrackedSection> tracked;
+
+    bool is_cancelled() const {
+        return cancelled.load(std::memory_order_relaxed);
+    }
+    void pass_done() {
+        if (on_pass && !is_cancelled()) on_pass();
+    }
+
+    // the parts the section spawned count when they are done. a section that
+    // is not final yet holds back on_section for its tracked section
+    void add_section(const ComputeSection& section, const RenderPass& pass,
+                     bool final = true) {
+        double area = (double)(section.end_x - section.start_x) *
+                      (section.end_y - section.start_y);
+        for (const ComputeSection& part : ThreadPool::spawned()) {
+            area -= (double)(part.end_x - part.start_x) *
+                    (part.end_y - part.start_y);
+        }
+        pixels_done.fetch_add((long)(area * pass.share()),
+                              std::memory_order_relaxed);
+        if (!tracked.empty() && pass.step == 1) {
+            _track(section, (long)area, final);
+        }
+    }
+
+    // counts down the pixels of sections for on_section, which has to be set
+    void track_sections(const std::vector<ComputeSection>& sections) {
+        tracked = std::vector<TrackedSection>(sections.size());
+        for (size_t i = 0; i < sections.size(); i++) {
+            const ComputeSection& s = sections[i];
+            tracked[i].section = s;
+            tracked[i].left =
+                (long)(s.end_x - s.start_x) * (s.end_y - s.start_y);
+        }
+    }
+
+    // reports the held sections once their pixels were redone
+    void release_sections() {
+        for (size_t i = 0; i < tracked.size(); i++) {
+            if (tracked[i].held && tracked[i].left == 0 && !is_cancelled()) {
+                on_section(i);
+            }
+        }
+    }
 
-// bounds of a section of a fractal that a section_renderer can compute
-struct ComputeSection {
-    int start_x, end_x, start_y, end_y;
-    // std::atomic<bool> computed = false;
+    // pieces split or spawned off a section lie inside it
+    void _track(const ComputeSection& piece, long area, bool final) {
+        for (size_t i = 0; i < tracked.size(); i++) {
+            TrackedSection& t = tracked[i];
+            if (piece.start_x < t.section.start_x ||
+                piece.start_x >= t.section.end_x ||
+                piece.start_y < t.section.start_y ||
+                piece.start_y >= t.section.end_y) {
+                continue;
+            }
+            if (!final) t.held = true;
+            // a piece cut short by a cancel counts as done, the cancel check
+            // keeps its section from being reported
+            if (t.left.fetch_sub(area) == area && !t.held && !is_cancelled()) {
+                on_section(i);
+            }
+            return;
+        }
+    }
 };
 
 // pool of computbe sections
 template <typename MType, MathFuncsConcept<MType> auto& M>
 struct ComputePool {
     std::vector<ComputeSection> sections;
-    std::atomic<int> computed = 0;
 
     // generate compute bounds based on fractal bounds
     void create_pool_section_bounds(FractalBounds<MType>& bounds,
                                     int _x_sections, int _y_sections) {
-        double section_width = (double)bounds.i_width / (double)_x_sections;
-        double section_height = (double)bounds.i_height / (double)_y_sections;
+        sections.clear();
+        add_region({0, bounds.i_width, 0, bounds.i_height}, _x_sections,
+                   _y_sections);
+    }
+
+    // splits region into _x_sections x _y_sections sections
+    void add_region(const ComputeSection& region, int _x_sections,
+                    int _y_sections) {
+        int region_width = region.end_x - region.start_x;
+        int region_height = region.end_y - region.start_y;
+        if (region_width <= 0 || region_height <= 0) return;
 
-        sections.resize(_x_sections * _y_sections);
+        double section_width = (double)region_width / (double)_x_sections;
+        double section_height = (double)region_height / (double)_y_sections;
 
         for (int _y = 0; _y < _y_sections; _y++) {
             for (int _x = 0; _x < _x_sections; _x++) {
-                ComputeSection& section = sections[_y * _x_sections + _x];
+                ComputeSection section;
 
-                section.start_x = _x * section_width;
-                section.start_y = _y * section_height;
+                section.start_x = region.start_x + (int)(_x * section_width);
+                section.start_y = region.start_y + (int)(_y * section_height);
 
-                section.end_x = (_x + 1) * section_width;
-                section.end_y = (_y + 1) * section_height;
+                section.end_x =
+                    region.start_x + (int)((_x + 1) * section_width);
+                section.end_y =
+                    region.start_y + (int)((_y + 1) * section_height);
+
+                if (section.end_x > section.start_x &&
+                    section.end_y > section.start_y) {
+                    sections.push_back(section);
+                }
             }
         }
     }
 
-    bool get_new_section(int& out) {
-        int index = computed.fetch_add(1);
+    // the l shaped part of a width x height view that IterationBuffer::shift
+    // by sx, sy leaves stale: the rows shifted in, then the columns shifted in
+    // beside the kept rows
+    void create_exposed_sections(int width, int height, int sx, int sy) {
+        sections.clear();
 
-        if (index >= (int)sections.size()) return false;  // no more sections
+        int kept_y0 = std::max(-sy, 0), kept_y1 = height - std::max(sy, 0);
+        if (sy > 0) add_region({0, width, kept_y1, height}, 10, 1);
+        if (sy < 0) add_region({0, width, 0, kept_y0}, 10, 1);
 
-        out = index;
-        return true;
+        if (sx > 0) add_region({width - sx, width, kept_y0, kept_y1}, 1, 10);
+        if (sx < 0) add_region({0, -sx, kept_y0, kept_y1}, 1, 10);
     }
 };
 
-template <typename MType, MathFuncsConcept<MType> auto& M,
-          SectionRendererFunc<MType, M> section_renderer>
-void _render_thread(int max_iter, FractalBounds<MType>& bounds,
-                    ComputePool<MType, M>& pool, MType& dx, MType& dy,
-                    std::vector<unsigned char>& pixels) {
-    while (1) {
-        // get section index
-        int index;
-        if (!pool.get_new_section(index)) {
-            return;
-        }
-
-        ComputeSection& section = pool.sections[index];
-
-        section_renderer(max_iter, bounds.x_min, bounds.y_min, bounds.i_width,
-                         bounds.i_height, section.start_x, section.end_x,
-                         section.start_y, section.end_y, dx, dy, pixels);
+inline long _sections_area(const std::vector<ComputeSection>& sections) {
+    long area = 0;
+    for (const ComputeSection& section : sections) {
+        area += (long)(section.end_x - section.start_x) *
+                (section.end_y - section.start_y);
     }
+    return area;
 }
 
-template <typename MType, MathFuncsConcept<MType> auto& M,
-          SectionRendererFunc<MType, M> section_renderer>
-void _render_fractal(FractalBounds<MType>& bounds, int res, int n_threads,
-                     int max_iter, std::vector<unsigned char>& pixels) {
-    std::cout << "renderer called" << std::endl;
-
-    // precompute constant for converting pixel-coords to fractal coord (may be
-    // slow bc of division)
-    MType dx, dy;
-    M.init(dx);
-    M.init(dy);
+template <typename MType, MathFuncsConcept<MType> auto& M>
+void _pixel_spacing(FractalBounds<MType>& bounds, MType& dx, MType& dy) {
     // dx = (x_max - x_min) / width
     M.sub(dx, bounds.x_max, bounds.x_min);
     M.div(dx, dx, bounds.width);
     // dy = (y_max - y_min) / height
     M.sub(dy, bounds.y_max, bounds.y_min);
     M.div(dy, dy, bounds.height);
+}
 
-    pixels.resize(bounds.i_width * bounds.i_height * 3);
+// renders bounds into out. with exposed only those sections are computed and
+// the rest of out is kept from an earlier render of the same pixels, see
+// ComputePool::create_exposed_sections
+template <typename MType, MathFuncsConcept<MType> auto& M,
+          SectionRendererFunc<MType, M> section_renderer>
+void _render_fractal(FractalBounds<MType>& bounds, int res, ThreadPool& threads,
+                     RenderProgress& progress, int max_iter,
+                     IterationBuffer& out,
+                     const std::vector<ComputeSection>* exposed = nullptr) {
+    std::cout << "renderer called" << std::endl;
+
+    // precompute constant for converting pixel-coords to fractal coord (may be
+    // slow bc of division)
+    ScratchFrame<MType, M> scratch;
+    MType& dx = scratch.get();
+    MType& dy = scratch.get();
+    _pixel_spacing<MType, M>(bounds, dx, dy);
 
     bounds.template update_rendered<M>();
 
     ComputePool<MType, M> pool;
-    pool.create_pool_section_bounds(bounds, 10, 10);
-
-    std::vector<std::thread> threads;
+    out.resume.stride = 2 * M.packed_size();
+    if (exposed) {
+        pool.sections = *exposed;
+    } else {
+        out.resize(bounds.i_width, bounds.i_height, SMOOTH_ITERATIONS);
+        out.iterations = max_iter;
+        out.resume.clear();
 
-    for (int x = 0; x < n_threads; x++) {
-        threads.emplace_back([&, max_iter] {
-            _render_thread<MType, M, section_renderer>(max_iter, bounds, pool,
-                                                       dx, dy, pixels);
-        });
+        pool.create_pool_section_bounds(bounds, 10, 10);
     }
-    for (std::thread& thread : threads) {
-        thread.join();
+    progress.pixels_total = _sections_area(pool.sections);
+    if (progress.on_section) progress.track_sections(pool.sections);
+
+    RenderTrace trace("render");
+
+    // coarse passes first, each one is shown as soon as it is done
+    for (RenderPass pass : _render_passes(res)) {
+        pass.clip = exposed != nullptr;
+        pass.cancelled = &progress.cancelled;
+        if (progress.is_cancelled()) return;
+
+        // a subdivision split into rows would compute a border around every
+        // piece, it hands halves of its rectangles to idle workers instead
+        int split_rows = THREAD_POOL_SPLIT_ROWS * pass.step;
+        if constexpr (section_renderer ==
+                      _subdivision_section_renderer<MType, M>) {
+            split_rows = 0;
+        }
+
+        threads.run(
+            pool.sections,
+            [&, max_iter](const ComputeSection& section) {
+                if (progress.is_cancelled()) return;
+
+                int64_t start = trace.now();
+                section_renderer(max_iter, bounds.x_min, bounds.y_min,
+                                 bounds.i_width, bounds.i_height,
+                                 section.start_x, section.end_x,
+                                 section.start_y, section.end_y, dx, dy, pass,
+                                 out);
+                trace.section(start, section, pass, out, max_iter);
+                progress.add_section(section, pass);
+            },
+            split_rows);
+
+        progress.pass_done();
     }
+
+    trace.finish(threads.size());
+}
+
+// raises the iteration limit of a finished render of bounds from
+// out.iterations to max_iter. escaped pixels keep their counts, the pixels on
+// out.resume go on from their saved z and the pixels proven inside move to the
+// new limit. the resume list has to come from a render with M
+template <typename MType, MathFuncsConcept<MType> auto& M>
+void _resume_fractal(FractalBounds<MType>& bounds, ThreadPool& threads,
+                     RenderProgress& progress, int max_iter,
+                     IterationBuffer& out) {
+    ScratchFrame<MType, M> scratch;
+    MType& dx = scratch.get();
+    MType& dy = scratch.get();
+    _pixel_spacing<MType, M>(bounds, dx, dy);
+
+    int from = out.iterations;
+    ResumeList list;
+    std::swap(list, out.resume);
+    out.resume.stride = list.stride;
+
+    int n_kept = list.pixels.size();
+    int n = list.size();
+    progress.pixels_total = n;
+
+    std::cout << "resuming " << n << " pixels from " << from << " iterations"
+              << std::endl;
+
+    // inside at the old limit is inside at any limit. the kept pixels are
+    // overwritten below
+    threads.parallel_chunks(out.height, 64, [&](int begin, int end) {
+        for (size_t i = (size_t)begin * out.width;
+             i < (size_t)end * out.width; i++) {
+            if (out.iters[i] == (uint32_t)from) out.iters[i] = max_iter;
+        }
+    });
+    out.iterations = max_iter;
+
+    threads.parallel_chunks(n, 256, [&](int begin, int end) {
+        if (progress.is_cancelled()) return;
+
+        MandelbrotKernel<MType, M> kernel;
+        ResumeList resume;
+        resume.stride = list.stride;
+
+        for (int i = begin; i < end; i++) {
+            uint32_t index =
+                i < n_kept ? list.pixels[i] : list.restart[i - n_kept];
+            int x = index % out.width, y = index / out.width;
+
+            int iter;
+            if (i < n_kept) {
+                iter = kernel.resume(max_iter, from,
+                                     list.z.data() + (size_t)i * list.stride,
+                                     bounds.x_min, bounds.y_min,
+                                     bounds.i_height, x, y, dx, dy);
+            } else {
+                iter = kernel.pixel(max_iter, bounds.x_min, bounds.y_min,
+                                    bounds.i_height, x, y, dx, dy);
+            }
+            out.set(x, y, iter, _smooth_fraction(kernel.escape_mag));
+            kernel.keep(resume, max_iter, iter, index);
+        }
+
+        out.add_resume(resume);
+        progress.pixels_done.fetch_add(end - begin, std::memory_order_relaxed);
+    });
+
+    progress.pass_done();
 }
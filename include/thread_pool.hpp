@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// bounds of a section of a fractal that a section_renderer can compute
+struct ComputeSection {
+    int start_x, end_x, start_y, end_y;
+};
+
+using SectionFunc = std::function<void(const ComputeSection&)>;
+
+// long lived render threads. every worker has its own deque of sections, pops
+// from its back and steals from the front of the others when it runs dry.
+// workers stay parked between runs, so a render does not pay thread startup
+struct ThreadPool {
+    struct Worker {
+        std::thread thread;
+        std::mutex mutex;
+        std::deque<ComputeSection> sections;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    // idle workers wait on it for sections split or spawned off running ones
+    std::condition_variable more;
+
+    // bumped for every run, parked workers wake up when it changes
+    uint64_t generation = 0;
+    bool stop = false;
+
+    // current run
+    SectionFunc func;
+    int split_rows = 0;
+    // mpfr precision of the thread that started the run, the workers take
+    // it on
+    long prec = 0;
+    // sections queued or running, the run is over at 0
+    std::atomic<int> pending = 0;
+    // workers looking for work, a running section splits off its rest while
+    // this is not 0
+    std::atomic<int> idle = 0;
+
+    // serializes runs of different callers
+    std::mutex run_mutex;
+
+    explicit ThreadPool(int n_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // restarts the workers if the count changed. 0 uses
+    // std::thread::hardware_concurrency
+    void set_threads(int n_threads);
+    int size() const { return workers.size(); }
+
+    // calls fn for every section and returns when all are done. with
+    // split_rows > 0 sections are computed split_rows rows at a time and a
+    // section still running while a worker is idle gives away half of its
+    // remaining rows
+    void run(const std::vector<ComputeSection>& sections, SectionFunc fn,
+             int split_rows = 0);
+
+    // calls fn(begin, end) for chunks of [0, n)
+    void parallel_chunks(int n, int chunk_size,
+                         const std::function<void(int, int)>& fn);
+
+    // from inside fn: whether a worker is looking for work
+    bool wants_work() const {
+        return idle.load(std::memory_order_relaxed) > 0;
+    }
+    // from inside fn: adds section to the current run, fn is called for it
+    // like for the others. the calling piece no longer covers it
+    void spawn(const ComputeSection& section);
+    // pool of the worker running on the calling thread, nullptr elsewhere
+    static ThreadPool* current();
+    // sections the piece running on the calling worker spawned so far
+    static const std::vector<ComputeSection>& spawned();
+
+    void _start(int n_threads);
+    void _stop();
+    void _worker_loop(int index);
+    bool _take(int index, ComputeSection& out);
+    void _execute(int index, ComputeSection section);
+    // wakes an idle worker for a section just queued on the calling worker
+    void _notify_more();
+};
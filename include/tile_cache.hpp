@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "iteration_buffer.hpp"
+#include "render_config.hpp"
+
+// a tile on the pixel grid of a zoom step. x and y are the tile column and
+// row, arbitrary size integers in hex since deep views are far more than 2^64
+// pixels from the origin. iterations and engine are what the tile was
+// computed with
+struct TileKey {
+    int zoom;
+    std::string x, y;
+    int iterations;
+    int engine;
+
+    bool operator==(const TileKey&) const = default;
+};
+
+struct TileKeyHash {
+    size_t operator()(const TileKey& key) const;
+};
+
+// TILE_SIZE x TILE_SIZE pixels of an IterationBuffer
+struct Tile {
+    std::vector<uint32_t> iters;
+    // empty without smooth fractions
+    std::vector<float> smooth;
+
+    size_t bytes() const;
+
+    // the tile with its top left pixel at x, y of buffer, which has to hold
+    // the whole tile
+    static std::shared_ptr<const Tile> cut(const IterationBuffer& buffer,
+                                           int x, int y);
+    // writes the tile to buffer with its top left pixel at x, y
+    void paste(IterationBuffer& buffer, int x, int y) const;
+};
+
+struct TileCacheStats {
+    uint64_t hits, misses;
+    size_t tiles, bytes;
+};
+
+// tiles of finished renders. once they take more than budget bytes the least
+// recently used ones are dropped
+struct TileCache {
+    size_t budget = TILE_CACHE_BYTES;
+    size_t bytes = 0;
+
+    // lookups through find since the cache was created
+    uint64_t hits = 0, misses = 0;
+
+    // most recently used first
+    using Entry = std::pair<TileKey, std::shared_ptr<const Tile>>;
+    std::list<Entry> lru;
+    std::unordered_map<TileKey, std::list<Entry>::iterator, TileKeyHash> index;
+
+    std::mutex mutex;
+
+    // the cached tile or nullptr, counted as a hit or a miss
+    std::shared_ptr<const Tile> find(const TileKey& key);
+    // like find without touching the order or the counts
+    bool contains(const TileKey& key);
+    void insert(const TileKey& key, std::shared_ptr<const Tile> tile);
+
+    void set_budget(size_t _budget);
+    void clear();
+    TileCacheStats stats();
+
+    // drops tiles until bytes fits the budget, mutex has to be held
+    void _evict();
+};
+
+// tiles covering a view that was snapped onto the pixel grid of its zoom
+// step. tile i, j has its top left pixel at i * TILE_SIZE - off_x,
+// j * TILE_SIZE - off_y of the view
+struct TileGrid {
+    int zoom = 0;
+    int off_x = 0, off_y = 0;
+    // TileKey::x of every tile column and TileKey::y of every tile row
+    std::vector<std::string> cols, rows;
+
+    TileKey key(int i, int j, int iterations, int engine) const {
+        return {zoom, cols[i], rows[j], iterations, engine};
+    }
+};
@@ -0,0 +1,238 @@
+// headless renderer: one view from the command line to an image file and a
+// json timing summary, without a window or gl
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "image_io.hpp"
+#include "palette.hpp"
+#include "render_config.hpp"
+#include "render_trace.hpp"
+#include "renderer.hpp"
+
+struct BatchOptions {
+    std::string center_x = "-0.5";
+    std::string center_y = "0";
+    std::string zoom = "1";
+    int width = 1920;
+    int height = 1080;
+    int iterations = 1024;
+    // "auto" or a math_type_name
+    std::string engine = "auto";
+    int threads = 0;
+    PaletteMode palette = PaletteMode::GRADIENT;
+    bool subdivision = true;
+    bool series_approximation = true;
+    std::string output = "xfractal.png";
+    // output with the extension replaced by .json if empty
+    std::string json;
+    // chrome trace of the render, needs RENDER_TRACE
+    std::string trace;
+};
+
+static void _usage(const char* name) {
+    std::cerr
+        << "usage: " << name << " [options]\n"
+        << "  --center-x STR     real part of the view center (-0.5)\n"
+        << "  --center-y STR     imaginary part of the view center (0)\n"
+        << "  --zoom STR         magnification, 1 is " << ZOOM_1_VIEW_WIDTH
+        << " wide (1)\n"
+        << "  --size WxH         image size in pixels (1920x1080)\n"
+        << "  --iterations N     iteration limit (1024)\n"
+        << "  --engine NAME      auto, double, double-double, fixed-point,\n"
+        << "                     mpfr, perturbation or bla (auto)\n"
+        << "  --threads N        render threads, 0 for all cores (0)\n"
+        << "  --palette NAME     grey, gradient or histogram (gradient)\n"
+        << "  --no-subdivision   no mariani-silver subdivision\n"
+        << "  --no-series        no series approximation\n"
+        << "  --output PATH      .png or .ppm image (xfractal.png)\n"
+        << "  --json PATH        timing summary (output as .json)\n"
+        << "  --trace PATH       chrome trace of the render, needs a build\n"
+        << "                     with RENDER_TRACE\n";
+}
+
+// value as a json string literal
+static std::string _json_string(const std::string& value) {
+    std::string out = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static bool _parse_engine(const std::string& name, MathType& type) {
+    constexpr MathType types[] = {
+        MathType::DOUBLE,      MathType::DOUBLE_DOUBLE, MathType::FIXED_POINT,
+        MathType::MPFR,        MathType::PERTURBATION,  MathType::BLA};
+    for (MathType t : types) {
+        if (name == math_type_name(t)) {
+            type = t;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool _parse_palette(const std::string& name, PaletteMode& mode) {
+    for (int i = 0; i <= (int)PaletteMode::HISTOGRAM; i++) {
+        if (name == palette_mode_name((PaletteMode)i)) {
+            mode = (PaletteMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool _parse_args(int argc, char** argv, BatchOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--no-subdivision") {
+            options.subdivision = false;
+            continue;
+        }
+        if (arg == "--no-series") {
+            options.series_approximation = false;
+            continue;
+        }
+
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+
+        if (arg == "--center-x") {
+            options.center_x = value;
+        } else if (arg == "--center-y") {
+            options.center_y = value;
+        } else if (arg == "--zoom") {
+            options.zoom = value;
+        } else if (arg == "--size") {
+            if (std::sscanf(value.c_str(), "%dx%d", &options.width,
+                            &options.height) != 2) {
+                return false;
+            }
+        } else if (arg == "--iterations") {
+            options.iterations = std::atoi(value.c_str());
+        } else if (arg == "--engine") {
+            options.engine = value;
+        } else if (arg == "--threads") {
+            options.threads = std::atoi(value.c_str());
+        } else if (arg == "--palette") {
+            if (!_parse_palette(value, options.palette)) return false;
+        } else if (arg == "--output") {
+            options.output = value;
+        } else if (arg == "--json") {
+            options.json = value;
+        } else if (arg == "--trace") {
+            options.trace = value;
+        } else {
+            return false;
+        }
+    }
+
+    return options.width > 0 && options.height > 0 && options.iterations > 0;
+}
+
+int main(int argc, char** argv) {
+    BatchOptions options;
+    if (!_parse_args(argc, argv, options)) {
+        _usage(argv[0]);
+        return 1;
+    }
+    if (!options.trace.empty() && !RENDER_TRACE) {
+        std::cerr << "built without RENDER_TRACE, no trace to write"
+                  << std::endl;
+        return 1;
+    }
+    if (options.json.empty()) {
+        size_t dot = options.output.find_last_of('.');
+        size_t dir = options.output.find_last_of("/\\");
+        if (dir != std::string::npos && dot < dir) dot = std::string::npos;
+        options.json = options.output.substr(0, dot) + ".json";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    Renderer renderer;
+    // one render, nothing to keep tiles for
+    renderer.tiling = false;
+    renderer.speculation = false;
+    renderer.iterations = options.iterations;
+    renderer.subdivision = options.subdivision;
+    renderer.series_approximation = options.series_approximation;
+    renderer.palette = options.palette;
+
+    renderer.init_bounds();
+    renderer.set_window_size_i(options.width, options.height);
+    renderer.set_fractal_bounds_d(-2.0, 1.0, -1.0, 1.0);
+    if (!renderer.set_view(options.center_x, options.center_y,
+                           options.zoom)) {
+        std::cerr << "cannot parse the center or zoom" << std::endl;
+        return 1;
+    }
+
+    if (options.engine != "auto") {
+        MathType type;
+        if (!_parse_engine(options.engine, type)) {
+            std::cerr << "unknown engine " << options.engine << std::endl;
+            return 1;
+        }
+        renderer.auto_math_type = false;
+        renderer.set_math_type(type);
+    }
+
+    int n_threads = options.threads > 0
+                        ? options.threads
+                        : (int)std::thread::hardware_concurrency();
+    auto render_start = std::chrono::steady_clock::now();
+    std::shared_ptr<RenderJob> job = renderer.render_async(1, n_threads);
+    job->wait();
+    auto render_end = std::chrono::steady_clock::now();
+
+    bool written = write_image(options.output, renderer.pixels, options.width,
+                               options.height);
+    auto end = std::chrono::steady_clock::now();
+    if (!written) {
+        std::cerr << "cannot write " << options.output << std::endl;
+        return 1;
+    }
+
+    if (!options.trace.empty() && !write_chrome_trace(options.trace)) {
+        std::cerr << "cannot write " << options.trace << std::endl;
+        return 1;
+    }
+
+    using ms = std::chrono::duration<double, std::milli>;
+    double pixels = (double)options.width * options.height;
+    std::ofstream json(options.json);
+    json << "{\n"
+         << "  \"center_x\": " << _json_string(options.center_x) << ",\n"
+         << "  \"center_y\": " << _json_string(options.center_y) << ",\n"
+         << "  \"zoom\": " << _json_string(options.zoom) << ",\n"
+         << "  \"width\": " << options.width << ",\n"
+         << "  \"height\": " << options.height << ",\n"
+         << "  \"iterations\": " << options.iterations << ",\n"
+         << "  \"engine\": \"" << math_type_name(job->type) << "\",\n"
+         << "  \"mpfr_precision\": " << MPFRMathFuncs::prec << ",\n"
+         << "  \"threads\": " << n_threads << ",\n"
+         << "  \"setup_ms\": " << ms(render_start - start).count() << ",\n"
+         << "  \"render_ms\": " << job->took_ms << ",\n"
+         << "  \"colorize_ms\": "
+         << ms(render_end - render_start).count() - job->took_ms << ",\n"
+         << "  \"write_ms\": " << ms(end - render_end).count() << ",\n"
+         << "  \"total_ms\": " << ms(end - start).count() << ",\n"
+         << "  \"pixels_per_second\": " << pixels / (job->took_ms / 1000.0)
+         << ",\n"
+         << "  \"output\": " << _json_string(options.output) << "\n"
+         << "}\n";
+    if (!json) {
+        std::cerr << "cannot write " << options.json << std::endl;
+        return 1;
+    }
+    return 0;
+}
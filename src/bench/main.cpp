@@ -0,0 +1,420 @@
+// benchmark suite: per operation timings of every math funcs implementation,
+// every engine on fixed locations and thread scaling of _render_fractal.
+// results go to a json file to compare between versions
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mandelbrot_renderer.hpp"
+#include "math.hpp"
+#include "render_config.hpp"
+#include "renderer.hpp"
+#include "simd_renderer.hpp"
+#include "thread_manager.hpp"
+
+// bumped when fields change meaning
+constexpr int BENCH_FORMAT = 1;
+// an op is repeated until one timing takes this long
+constexpr double BENCH_MIN_OP_MS = 50.0;
+
+constexpr FloatExpMathFuncs floatexp_math_funcs{};
+
+// fixed views, they only have to stay the same between versions. the deep
+// ones zoom into the seahorse valley point of the wikipedia zoom sequence
+struct BenchLocation {
+    const char* name;
+    const char* center_x;
+    const char* center_y;
+    const char* zoom;
+    int iterations;
+};
+
+static const BenchLocation bench_locations[] = {
+    {"shallow", "-0.5", "0", "1", 1000},
+    {"seahorse", "-0.7436438870371587", "0.1318259042053120", "1e3", 2000},
+    {"deep-1e30", "-0.743643887037158704752191506114774",
+     "0.131825904205311970493132056385139", "1e30", 5000},
+    {"deep-1e100", "-0.743643887037158704752191506114774",
+     "0.131825904205311970493132056385139", "1e100", 10000},
+};
+
+struct OpResult {
+    std::string math;
+    int precision;
+    std::string op;
+    double ns_per_op;
+};
+
+struct KernelResult {
+    std::string location;
+    std::string engine;
+    int width, height, iterations;
+    int precision;
+    double ms;
+};
+
+struct ScalingResult {
+    std::string kernel;
+    int threads;
+    double ms;
+};
+
+struct BenchOptions {
+    int width = 192;
+    int height = 108;
+    int threads = 0;
+    // best of this many runs per kernel and scaling timing
+    int repeat = 3;
+    // names to run, all if empty
+    std::vector<std::string> locations;
+    std::vector<std::string> engines;
+    bool ops = true;
+    bool kernels = true;
+    bool scaling = true;
+    std::string output = "xfractal_bench.json";
+};
+
+static double _ms_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+// ns per call of body(n) / n, doubling n until a run takes BENCH_MIN_OP_MS
+static double _time_op(const std::function<void(long)>& body) {
+    for (long n = 1024;; n *= 2) {
+        auto start = std::chrono::steady_clock::now();
+        body(n);
+        double ms = _ms_since(start);
+        if (ms >= BENCH_MIN_OP_MS || n >= (1l << 40)) return ms * 1e6 / n;
+    }
+}
+
+// operands come from volatiles so the compiler cannot fold the chains
+static volatile double bench_seed_one = 1.0;
+static volatile double bench_seed_step = 1.0 + 1e-9;
+static volatile double bench_seed_half = 0.5;
+static volatile double bench_sink = 0.0;
+
+template <typename MType, MathFuncsConcept<MType> auto& M>
+void _bench_ops(const std::string& math, int precision,
+                std::vector<OpResult>& out) {
+    MType r, a, h;
+    M.init_set_d(r, bench_seed_one);
+    M.init_set_d(a, bench_seed_step);
+    M.init_set_d(h, bench_seed_half);
+
+    // every op feeds the next, values stay near 1
+    auto add = [&](const char* op, const std::function<void(long)>& body) {
+        M.set_d(r, bench_seed_one);
+        double ns = _time_op(body);
+        bench_sink = bench_sink + M.get_d(r);
+        out.push_back({math, precision, op, ns});
+        std::cout << "bench: " << math << " " << precision << " " << op << " "
+                  << ns << " ns" << std::endl;
+    };
+
+    add("add", [&](long n) {
+        for (long i = 0; i < n; i++) M.add(r, r, a);
+    });
+    add("sub", [&](long n) {
+        for (long i = 0; i < n; i++) M.sub(r, r, a);
+    });
+    add("mul", [&](long n) {
+        for (long i = 0; i < n; i++) M.mul(r, r, a);
+    });
+    add("div", [&](long n) {
+        for (long i = 0; i < n; i++) M.div(r, r, a);
+    });
+    // 1 squared stays 1
+    add("sqr", [&](long n) {
+        for (long i = 0; i < n; i++) M.sqr(r, r);
+    });
+    // r = r / 2 + 1 / 2 goes to 1
+    add("fma", [&](long n) {
+        for (long i = 0; i < n; i++) M.fma(r, r, h, h);
+    });
+    add("mul_2si", [&](long n) {
+        for (long i = 0; i < n; i++) M.mul_2si(r, r, (i & 1) ? -1 : 1);
+    });
+    add("cmp", [&](long n) {
+        int sum = 0;
+        for (long i = 0; i < n; i++) sum += M.cmp(r, a);
+        bench_sink = bench_sink + sum;
+    });
+
+    M.clear(r);
+    M.clear(a);
+    M.clear(h);
+}
+
+static void _run_ops(std::vector<OpResult>& out) {
+    _bench_ops<double, Renderer::double_math_funcs>("double", 53, out);
+    _bench_ops<DoubleDouble, Renderer::dd_math_funcs>("double-double", 106,
+                                                      out);
+    _bench_ops<FixedPoint<FIXED_POINT_LIMBS>, Renderer::fp_math_funcs>(
+        "fixed-point", 64 * FIXED_POINT_LIMBS, out);
+    _bench_ops<FloatExp, floatexp_math_funcs>("floatexp", 53, out);
+
+    mpfr_prec_t prec = MPFRMathFuncs::prec;
+    for (int bits : {128, 512, 2048}) {
+        MPFRMathFuncs::prec = bits;
+        _bench_ops<mpfr_t, Renderer::mpfr_math_funcs>("mpfr", bits, out);
+    }
+    MPFRMathFuncs::prec = prec;
+}
+
+static bool _selected(const std::vector<std::string>& names,
+                      const std::string& name) {
+    return names.empty() ||
+           std::find(names.begin(), names.end(), name) != names.end();
+}
+
+static void _run_kernels(const BenchOptions& options, int n_threads,
+                         std::vector<KernelResult>& out) {
+    constexpr MathType types[] = {
+        MathType::DOUBLE,      MathType::DOUBLE_DOUBLE, MathType::FIXED_POINT,
+        MathType::MPFR,        MathType::PERTURBATION,  MathType::BLA};
+
+    Renderer renderer;
+    renderer.tiling = false;
+    renderer.speculation = false;
+    renderer.auto_math_type = false;
+    renderer.init_bounds();
+    renderer.set_window_size_i(options.width, options.height);
+    renderer.set_fractal_bounds_d(-2.0, 1.0, -1.0, 1.0);
+
+    for (const BenchLocation& location : bench_locations) {
+        if (!_selected(options.locations, location.name)) continue;
+
+        renderer.set_view(location.center_x, location.center_y,
+                          location.zoom);
+        renderer.iterations = location.iterations;
+        int bits = renderer.required_bits(renderer.mpfr_bounds);
+
+        for (MathType type : types) {
+            if (!_selected(options.engines, math_type_name(type))) continue;
+            // engines that cannot tell the pixels apart are not timed
+            if ((type == MathType::DOUBLE && bits > AUTO_DOUBLE_BITS) ||
+                (type == MathType::DOUBLE_DOUBLE &&
+                 bits > AUTO_DOUBLE_DOUBLE_BITS) ||
+                (type == MathType::FIXED_POINT &&
+                 bits > AUTO_FIXED_POINT_BITS)) {
+                continue;
+            }
+            renderer.set_math_type(type);
+
+            double best = 0.0;
+            for (int run = 0; run < options.repeat; run++) {
+                // every run computes its own reference orbit
+                renderer.references.valid = false;
+                auto job = renderer.render_async(1, n_threads);
+                job->wait();
+                if (run == 0 || job->took_ms < best) best = job->took_ms;
+            }
+
+            out.push_back({location.name, math_type_name(type), options.width,
+                           options.height, location.iterations,
+                           (int)MPFRMathFuncs::prec, best});
+            std::cout << "bench: " << location.name << " "
+                      << math_type_name(type) << " " << best << " ms"
+                      << std::endl;
+        }
+    }
+}
+
+template <SectionRendererFunc<double, Renderer::double_math_funcs> renderer>
+void _run_scaling(const std::string& kernel, const BenchOptions& options,
+                  int max_threads, std::vector<ScalingResult>& out) {
+    constexpr auto& M = Renderer::double_math_funcs;
+    const BenchLocation& location = bench_locations[1];
+
+    FractalBounds<double> bounds;
+    bounds.init<M>();
+    bounds.set_sizes_i<M>(options.width * 4, options.height * 4);
+    // the seahorse view, in doubles
+    double cx = std::atof(location.center_x), cy = std::atof(location.center_y);
+    double half_w = ZOOM_1_VIEW_WIDTH / 2 / std::atof(location.zoom);
+    double half_h = half_w * options.height / options.width;
+    bounds.set_bounds_d<M>(cx - half_w, cx + half_w, cy - half_h, cy + half_h);
+
+    std::vector<int> counts;
+    for (int n = 1; n < max_threads; n *= 2) counts.push_back(n);
+    counts.push_back(max_threads);
+
+    IterationBuffer buffer;
+    for (int n : counts) {
+        ThreadPool threads(n);
+        double best = 0.0;
+        for (int run = 0; run < options.repeat; run++) {
+            RenderProgress progress;
+            auto start = std::chrono::steady_clock::now();
+            _render_fractal<double, M, renderer>(bounds, 1, threads, progress,
+                                                 location.iterations, buffer);
+            double ms = _ms_since(start);
+            if (run == 0 || ms < best) best = ms;
+        }
+        out.push_back({kernel, n, best});
+        std::cout << "bench: " << kernel << " " << n << " threads " << best
+                  << " ms" << std::endl;
+    }
+    bounds.clear<M>();
+}
+
+static std::vector<std::string> _split(const std::string& list) {
+    std::vector<std::string> names;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        if (end > start) names.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    return names;
+}
+
+static void _usage(const char* name) {
+    std::cerr
+        << "usage: " << name << " [options]\n"
+        << "  --size WxH          kernel benchmark size (192x108), the\n"
+        << "                      scaling sweep renders 4x4 times that\n"
+        << "  --threads N         kernel benchmark threads and largest\n"
+        << "                      scaling count, 0 for all cores (0)\n"
+        << "  --repeat N          best of N runs (3)\n"
+        << "  --locations A,B     shallow, seahorse, deep-1e30, deep-1e100\n"
+        << "  --engines A,B       double, double-double, fixed-point, mpfr,\n"
+        << "                      perturbation, bla\n"
+        << "  --no-ops            skip the math funcs benchmarks\n"
+        << "  --no-kernels        skip the engine benchmarks\n"
+        << "  --no-scaling        skip the thread scaling sweep\n"
+        << "  --output PATH       json results (xfractal_bench.json)\n";
+}
+
+static bool _parse_args(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--no-ops") {
+            options.ops = false;
+            continue;
+        }
+        if (arg == "--no-kernels") {
+            options.kernels = false;
+            continue;
+        }
+        if (arg == "--no-scaling") {
+            options.scaling = false;
+            continue;
+        }
+
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+
+        if (arg == "--size") {
+            if (std::sscanf(value.c_str(), "%dx%d", &options.width,
+                            &options.height) != 2) {
+                return false;
+            }
+        } else if (arg == "--threads") {
+            options.threads = std::atoi(value.c_str());
+        } else if (arg == "--repeat") {
+            options.repeat = std::atoi(value.c_str());
+        } else if (arg == "--locations") {
+            options.locations = _split(value);
+        } else if (arg == "--engines") {
+            options.engines = _split(value);
+        } else if (arg == "--output") {
+            options.output = value;
+        } else {
+            return false;
+        }
+    }
+
+    return options.width > 0 && options.height > 0 && options.repeat > 0;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!_parse_args(argc, argv, options)) {
+        _usage(argv[0]);
+        return 1;
+    }
+    int n_threads = options.threads > 0
+                        ? options.threads
+                        : (int)std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<OpResult> ops;
+    std::vector<KernelResult> kernels;
+    std::vector<ScalingResult> scaling;
+
+    if (options.ops) _run_ops(ops);
+    if (options.kernels) _run_kernels(options, n_threads, kernels);
+    if (options.scaling) {
+        _run_scaling<_mandelbrot_section_renderer<
+            double, Renderer::double_math_funcs>>("generic", options,
+                                                  n_threads, scaling);
+        _run_scaling<_simd_section_renderer>(
+            std::string("simd-") + _simd_kernel_name(), options, n_threads,
+            scaling);
+    }
+
+    std::ofstream json(options.output);
+    json << "{\n"
+         << "  \"format\": " << BENCH_FORMAT << ",\n"
+         << "  \"hardware_threads\": " << std::thread::hardware_concurrency()
+         << ",\n"
+         << "  \"simd_kernel\": \"" << _simd_kernel_name() << "\",\n";
+
+    json << "  \"ops\": [";
+    for (size_t i = 0; i < ops.size(); i++) {
+        const OpResult& r = ops[i];
+        json << (i ? ",\n" : "\n") << "    {\"math\": \"" << r.math
+             << "\", \"precision\": " << r.precision << ", \"op\": \"" << r.op
+             << "\", \"ns_per_op\": " << r.ns_per_op << "}";
+    }
+    json << "\n  ],\n";
+
+    json << "  \"kernels\": [";
+    for (size_t i = 0; i < kernels.size(); i++) {
+        const KernelResult& r = kernels[i];
+        json << (i ? ",\n" : "\n") << "    {\"location\": \"" << r.location
+             << "\", \"engine\": \"" << r.engine << "\", \"width\": "
+             << r.width << ", \"height\": " << r.height
+             << ", \"iterations\": " << r.iterations
+             << ", \"mpfr_precision\": " << r.precision
+             << ", \"threads\": " << n_threads << ", \"ms\": " << r.ms
+             << ", \"pixels_per_second\": "
+             << (double)r.width * r.height / (r.ms / 1000.0) << "}";
+    }
+    json << "\n  ],\n";
+
+    json << "  \"scaling\": [";
+    for (size_t i = 0; i < scaling.size(); i++) {
+        const ScalingResult& r = scaling[i];
+        // speedup over the first count of the same kernel
+        double base = r.ms;
+        for (const ScalingResult& s : scaling) {
+            if (s.kernel == r.kernel) {
+                base = s.ms;
+                break;
+            }
+        }
+        json << (i ? ",\n" : "\n") << "    {\"kernel\": \"" << r.kernel
+             << "\", \"threads\": " << r.threads << ", \"ms\": " << r.ms
+             << ", \"speedup\": " << base / r.ms << "}";
+    }
+    json << "\n  ]\n}\n";
+
+    if (!json) {
+        std::cerr << "cannot write " << options.output << std::endl;
+        return 1;
+    }
+    return 0;
+}
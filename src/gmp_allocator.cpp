@@ -0,0 +1,225 @@
+#include "gmp_allocator.hpp"
+
+#include <gmp.h>
+#include <mpfr.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "math.hpp"
+#include "render_config.hpp"
+
+// blocks of 16 << c bytes for class c
+constexpr size_t GMP_POOL_MIN_BLOCK = 16;
+constexpr int GMP_POOL_CLASSES =
+    std::countr_zero(GMP_POOL_MAX_BLOCK / GMP_POOL_MIN_BLOCK) + 1;
+
+static_assert(std::has_single_bit(GMP_POOL_MAX_BLOCK) &&
+                  GMP_POOL_MAX_BLOCK >= GMP_POOL_MIN_BLOCK,
+              "GMP_POOL_MAX_BLOCK has to be a power of two");
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+// memory of exited threads, picked up again by new threads. chunks are never
+// returned to the system
+struct GMPDepot {
+    std::mutex mutex;
+    FreeBlock* free[GMP_POOL_CLASSES] = {};
+    std::vector<std::pair<char*, size_t>> chunks;
+};
+
+static GMPDepot depot;
+
+static std::atomic<bool> installed = false;
+static std::atomic<uint64_t> stat_allocs = 0;
+static std::atomic<uint64_t> stat_bytes = 0;
+
+static int _size_class(size_t size) {
+    if (size <= GMP_POOL_MIN_BLOCK) return 0;
+    return std::bit_width((size - 1) / GMP_POOL_MIN_BLOCK);
+}
+
+static size_t _class_size(int c) { return GMP_POOL_MIN_BLOCK << c; }
+
+struct GMPPool {
+    FreeBlock* free[GMP_POOL_CLASSES] = {};
+
+    // unused rest of the current chunk
+    char* bump = nullptr;
+    size_t bump_left = 0;
+
+    // set while the thread local pool exists, frees during thread exit after
+    // it is gone go to the depot
+    static inline thread_local bool alive = false;
+
+    GMPPool() { alive = true; }
+
+    ~GMPPool() {
+        alive = false;
+
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        for (int c = 0; c < GMP_POOL_CLASSES; c++) {
+            while (free[c]) {
+                FreeBlock* block = free[c];
+                free[c] = block->next;
+                block->next = depot.free[c];
+                depot.free[c] = block;
+            }
+        }
+        if (bump_left >= GMP_POOL_MIN_BLOCK) {
+            depot.chunks.push_back({bump, bump_left});
+        }
+    }
+
+    // refills the bump region. chunks hold at least GMP_POOL_CHUNK_BLOCKS
+    // limb buffers of an mpfr_t at the current precision
+    void refill(size_t need) {
+        {
+            std::lock_guard<std::mutex> lock(depot.mutex);
+            for (size_t i = 0; i < depot.chunks.size(); i++) {
+                if (depot.chunks[i].second >= need) {
+                    bump = depot.chunks[i].first;
+                    bump_left = depot.chunks[i].second;
+                    depot.chunks.erase(depot.chunks.begin() + i);
+                    return;
+                }
+            }
+        }
+
+        size_t limbs = mpfr_custom_get_size(MPFRMathFuncs::prec) +
+                       sizeof(mp_limb_t);
+        size_t size = std::max({GMP_POOL_CHUNK,
+                                GMP_POOL_CHUNK_BLOCKS * std::bit_ceil(limbs),
+                                need});
+        bump = (char*)std::malloc(size);
+        bump_left = bump ? size : 0;
+    }
+
+    void* alloc(int c) {
+        if (free[c]) {
+            FreeBlock* block = free[c];
+            free[c] = block->next;
+            return block;
+        }
+
+        // blocks freed by exited threads first
+        {
+            std::lock_guard<std::mutex> lock(depot.mutex);
+            if (depot.free[c]) {
+                free[c] = depot.free[c];
+                depot.free[c] = nullptr;
+            }
+        }
+        if (free[c]) return alloc(c);
+
+        size_t size = _class_size(c);
+        if (bump_left < size) {
+            // the rest of the old chunk is too small for this class, keep it
+            // for the smaller ones
+            while (bump_left >= GMP_POOL_MIN_BLOCK) {
+                int small = _size_class(bump_left + 1) - 1;
+                FreeBlock* block = (FreeBlock*)bump;
+                block->next = free[small];
+                free[small] = block;
+                bump += _class_size(small);
+                bump_left -= _class_size(small);
+            }
+            refill(size);
+            if (bump_left < size) return nullptr;
+        }
+
+        void* p = bump;
+        bump += size;
+        bump_left -= size;
+        return p;
+    }
+
+    void release(void* p, int c) {
+        FreeBlock* block = (FreeBlock*)p;
+        block->next = free[c];
+        free[c] = block;
+    }
+};
+
+static GMPPool& _local_pool() {
+    thread_local GMPPool pool;
+    return pool;
+}
+
+static void _release(void* p, size_t size) {
+    int c = _size_class(size);
+    if (GMPPool::alive) {
+        _local_pool().release(p, c);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(depot.mutex);
+    FreeBlock* block = (FreeBlock*)p;
+    block->next = depot.free[c];
+    depot.free[c] = block;
+}
+
+static void* _gmp_alloc(size_t size) {
+    stat_allocs.fetch_add(1, std::memory_order_relaxed);
+    stat_bytes.fetch_add(size, std::memory_order_relaxed);
+
+    void* p = size <= GMP_POOL_MAX_BLOCK ? _local_pool().alloc(_size_class(size))
+                                         : std::malloc(size);
+    if (!p) std::abort();
+    return p;
+}
+
+static void _gmp_free(void* p, size_t size) {
+    if (!p) return;
+    if (size > GMP_POOL_MAX_BLOCK) {
+        std::free(p);
+        return;
+    }
+    _release(p, size);
+}
+
+static void* _gmp_realloc(void* p, size_t old_size, size_t new_size) {
+    if (old_size > GMP_POOL_MAX_BLOCK && new_size > GMP_POOL_MAX_BLOCK) {
+        stat_allocs.fetch_add(1, std::memory_order_relaxed);
+        stat_bytes.fetch_add(new_size, std::memory_order_relaxed);
+
+        void* n = std::realloc(p, new_size);
+        if (!n) std::abort();
+        return n;
+    }
+
+    // shrinking or growing within the block size keeps the block
+    if (old_size <= GMP_POOL_MAX_BLOCK && new_size <= GMP_POOL_MAX_BLOCK &&
+        _size_class(old_size) == _size_class(new_size)) {
+        return p;
+    }
+
+    void* n = _gmp_alloc(new_size);
+    std::memcpy(n, p, std::min(old_size, new_size));
+    _gmp_free(p, old_size);
+    return n;
+}
+
+void gmp_allocator_install() {
+    if (installed.exchange(true)) return;
+    mp_set_memory_functions(_gmp_alloc, _gmp_realloc, _gmp_free);
+}
+
+bool gmp_allocator_installed() { return installed; }
+
+GMPAllocStats gmp_allocator_stats() {
+    return {stat_allocs.load(std::memory_order_relaxed),
+            stat_bytes.load(std::memory_order_relaxed)};
+}
+
+void gmp_allocator_reset_stats() {
+    stat_allocs.store(0, std::memory_order_relaxed);
+    stat_bytes.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,114 @@
+#include "image_io.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+
+bool write_ppm(const std::string& path, const std::vector<unsigned char>& rgb,
+               int width, int height) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+
+    out << "P6\n" << width << ' ' << height << "\n255\n";
+    out.write((const char*)rgb.data(), (std::streamsize)width * height * 3);
+    return (bool)out;
+}
+
+static uint32_t _crc32(const unsigned char* data, size_t size,
+                       uint32_t crc = 0) {
+    static uint32_t table[256] = {};
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void _put_u32(std::vector<unsigned char>& out, uint32_t v) {
+    out.push_back(v >> 24);
+    out.push_back(v >> 16);
+    out.push_back(v >> 8);
+    out.push_back(v);
+}
+
+// length, type, data and the crc of type and data
+static void _write_chunk(std::ofstream& out, const char* type,
+                         const std::vector<unsigned char>& data) {
+    std::vector<unsigned char> chunk;
+    _put_u32(chunk, data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    _put_u32(chunk, _crc32(chunk.data() + 4, chunk.size() - 4));
+    out.write((const char*)chunk.data(), chunk.size());
+}
+
+bool write_png(const std::string& path, const std::vector<unsigned char>& rgb,
+               int width, int height) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+
+    const unsigned char signature[] = {0x89, 'P',  'N',  'G',
+                                       '\r', '\n', 0x1a, '\n'};
+    out.write((const char*)signature, sizeof(signature));
+
+    // 8 bit rgb, no interlacing
+    std::vector<unsigned char> header;
+    _put_u32(header, width);
+    _put_u32(header, height);
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    _write_chunk(out, "IHDR", header);
+
+    // every row starts with filter type 0
+    size_t row_bytes = (size_t)width * 3;
+    std::vector<unsigned char> raw;
+    raw.reserve((row_bytes + 1) * height);
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);
+        auto row = rgb.begin() + y * row_bytes;
+        raw.insert(raw.end(), row, row + row_bytes);
+    }
+
+    // zlib stream of stored blocks of up to 65535 bytes
+    std::vector<unsigned char> data = {0x78, 0x01};
+    uint32_t a = 1, b = 0;
+    size_t pos = 0;
+    do {
+        size_t size = std::min<size_t>(raw.size() - pos, 65535);
+        bool last = pos + size == raw.size();
+        data.push_back(last ? 1 : 0);
+        data.push_back(size & 0xff);
+        data.push_back(size >> 8);
+        data.push_back(~size & 0xff);
+        data.push_back((~size >> 8) & 0xff);
+        data.insert(data.end(), raw.begin() + pos, raw.begin() + pos + size);
+
+        for (size_t i = pos; i < pos + size; i++) {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        pos += size;
+    } while (pos < raw.size());
+    _put_u32(data, (b << 16) | a);
+    _write_chunk(out, "IDAT", data);
+
+    _write_chunk(out, "IEND", {});
+    return (bool)out;
+}
+
+bool write_image(const std::string& path,
+                 const std::vector<unsigned char>& rgb, int width, int height) {
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".png") == 0) {
+        return write_png(path, rgb, width, height);
+    }
+    return write_ppm(path, rgb, width, height);
+}
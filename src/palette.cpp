@@ -0,0 +1,150 @@
+#include "palette.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+
+#include "render_config.hpp"
+
+struct RGB {
+    unsigned char r, g, b;
+};
+
+// stops of the gradient, evenly spaced and wrapping around
+static const RGB gradient_stops[] = {{0, 7, 100},
+                                     {32, 107, 203},
+                                     {237, 255, 255},
+                                     {255, 170, 0},
+                                     {0, 2, 0}};
+constexpr int N_GRADIENT_STOPS =
+    sizeof(gradient_stops) / sizeof(gradient_stops[0]);
+
+static RGB _lerp(const RGB& a, const RGB& b, float t) {
+    return {(unsigned char)(a.r + (b.r - a.r) * t),
+            (unsigned char)(a.g + (b.g - a.g) * t),
+            (unsigned char)(a.b + (b.b - a.b) * t)};
+}
+
+// t in [0, 1)
+static RGB _gradient(double t) {
+    double pos = t * N_GRADIENT_STOPS;
+    int i = (int)pos % N_GRADIENT_STOPS;
+    return _lerp(gradient_stops[i], gradient_stops[(i + 1) % N_GRADIENT_STOPS],
+                 (float)(pos - (int)pos));
+}
+
+// histogram of the escaped pixels, counted per chunk of rows and merged
+static std::vector<uint64_t> _histogram(const IterationBuffer& buffer,
+                                        ThreadPool& threads) {
+    std::vector<uint64_t> hist(buffer.iterations, 0);
+    std::mutex mutex;
+
+    threads.parallel_chunks(buffer.height, 64, [&](int begin, int end) {
+        std::vector<uint64_t> local(buffer.iterations, 0);
+        for (size_t i = (size_t)begin * buffer.width;
+             i < (size_t)end * buffer.width; i++) {
+            uint32_t iter = buffer.iters[i];
+            if (iter < (uint32_t)buffer.iterations) local[iter]++;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < buffer.iterations; i++) {
+            hist[i] += local[i];
+        }
+    });
+    return hist;
+}
+
+// colour of every iteration count from 0 to buffer.iterations (inside)
+static std::vector<RGB> _build_lut(const IterationBuffer& buffer,
+                                   PaletteMode mode, ThreadPool& threads) {
+    int iterations = buffer.iterations;
+    std::vector<RGB> lut(iterations + 1);
+
+    switch (mode) {
+        case PaletteMode::GREY: {
+            for (int i = 0; i <= iterations; i++) {
+                unsigned char c = (unsigned char)(255.0f * i / iterations);
+                lut[i] = {c, c, c};
+            }
+            return lut;
+        }
+        case PaletteMode::GRADIENT: {
+            for (int i = 0; i < iterations; i++) {
+                lut[i] = _gradient((double)(i % PALETTE_PERIOD) /
+                                   PALETTE_PERIOD);
+            }
+            break;
+        }
+        case PaletteMode::HISTOGRAM: {
+            std::vector<uint64_t> hist = _histogram(buffer, threads);
+            uint64_t total = 0;
+            for (uint64_t count : hist) total += count;
+
+            uint64_t below = 0;
+            for (int i = 0; i < iterations; i++) {
+                lut[i] = _gradient(total ? 0.999 * below / total : 0.0);
+                below += hist[i];
+            }
+            break;
+        }
+    }
+
+    lut[iterations] = {0, 0, 0};
+    return lut;
+}
+
+const char* palette_mode_name(PaletteMode mode) {
+    switch (mode) {
+        case PaletteMode::GREY:
+            return "grey";
+        case PaletteMode::GRADIENT:
+            return "gradient";
+        case PaletteMode::HISTOGRAM:
+            return "histogram";
+    }
+    return "unknown";
+}
+
+void colorize(const IterationBuffer& buffer, PaletteMode mode,
+              std::vector<unsigned char>& pixels, ThreadPool& threads) {
+    if (buffer.iterations <= 0 || buffer.iters.empty()) return;
+
+    std::vector<RGB> lut = _build_lut(buffer, mode, threads);
+    int iterations = buffer.iterations;
+
+    // grey keeps the plain counts
+    bool smooth = !buffer.smooth.empty() && mode != PaletteMode::GREY;
+
+    pixels.resize(buffer.iters.size() * 3);
+
+    threads.parallel_chunks(buffer.height, 16, [&](int begin, int end) {
+        size_t i_end = (size_t)end * buffer.width;
+        unsigned char* out = pixels.data() + (size_t)begin * buffer.width * 3;
+
+        if (!smooth) {
+            for (size_t i = (size_t)begin * buffer.width; i < i_end; i++) {
+                const RGB& c = lut[std::min<uint32_t>(buffer.iters[i],
+                                                      iterations)];
+                *out++ = c.r;
+                *out++ = c.g;
+                *out++ = c.b;
+            }
+            return;
+        }
+
+        for (size_t i = (size_t)begin * buffer.width; i < i_end; i++) {
+            uint32_t iter = std::min<uint32_t>(buffer.iters[i], iterations);
+            RGB c = lut[iter];
+            // escaped pixels blend towards the next count, never into the
+            // inside colour
+            if ((int)iter < iterations) {
+                uint32_t next = std::min<uint32_t>(iter + 1, iterations - 1);
+                c = _lerp(c, lut[next], buffer.smooth[i]);
+            }
+            *out++ = c.r;
+            *out++ = c.g;
+            *out++ = c.b;
+        }
+    });
+}
@@ -0,0 +1,258 @@
+#include "render_trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+
+// a finished render, for the summaries and the trace file
+struct TraceRender {
+    int id;
+    const char* name;
+    int64_t start_ns, end_ns;
+    int threads;
+};
+
+// renders kept for the trace file, about as far back as the rings go
+constexpr size_t TRACE_MAX_RENDERS = 1024;
+
+static std::mutex trace_mutex;
+// rings of every thread that recorded something, threads that end leave
+// theirs behind
+static std::vector<std::unique_ptr<TraceRing>> trace_rings;
+static std::vector<TraceRender> trace_renders;
+static std::atomic<int> trace_next_render = 1;
+
+int64_t trace_now_ns() {
+    static const auto origin = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - origin)
+        .count();
+}
+
+TraceRing& trace_ring() {
+    thread_local TraceRing* ring = nullptr;
+    if (!ring) {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        trace_rings.push_back(std::make_unique<TraceRing>());
+        ring = trace_rings.back().get();
+        ring->thread = trace_rings.size();
+        ring->events.reserve(TRACE_RING_EVENTS);
+    }
+    return *ring;
+}
+
+void TraceRing::push(const TraceEvent& event) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (events.size() < TRACE_RING_EVENTS) {
+        events.push_back(event);
+    } else {
+        events[next] = event;
+    }
+    next = (next + 1) % TRACE_RING_EVENTS;
+}
+
+std::vector<TraceEvent> TraceRing::snapshot() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (events.size() < TRACE_RING_EVENTS) return events;
+
+    std::vector<TraceEvent> out(events.begin() + next, events.end());
+    out.insert(out.end(), events.begin(), events.begin() + next);
+    return out;
+}
+
+void RenderTrace::_begin() {
+    id = trace_next_render.fetch_add(1);
+    start_ns = trace_now_ns();
+}
+
+void RenderTrace::_section(int64_t start, const ComputeSection& section,
+                           const RenderPass& pass, const IterationBuffer& out,
+                           int max_iter) {
+    TraceEvent event;
+    event.start_ns = start;
+    event.end_ns = trace_now_ns();
+    event.render = id;
+    event.step = pass.step;
+    event.section = section;
+    event.pixels = 0;
+    event.escaped = 0;
+    event.iterations = trace_iterations;
+
+    // parts the section spawned are recorded as sections of their own
+    const std::vector<ComputeSection>& spawned = ThreadPool::spawned();
+    auto in_spawned = [&spawned](int x, int y) {
+        for (const ComputeSection& part : spawned) {
+            if (x >= part.start_x && x < part.end_x && y >= part.start_y &&
+                y < part.end_y) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    for (int y = pass.first_row(section.start_y); y < section.end_y;
+         y += pass.step) {
+        int x, stride;
+        pass.row(y, section.start_x, x, stride);
+        for (; x < section.end_x; x += stride) {
+            if (in_spawned(x, y)) continue;
+            uint32_t iter = out.iters[(size_t)y * out.width + x];
+            event.pixels++;
+            if ((int)iter < max_iter) event.escaped++;
+        }
+    }
+
+    trace_ring().push(event);
+}
+
+// every event of every ring
+static std::vector<std::pair<int, TraceEvent>> _trace_events() {
+    std::vector<TraceRing*> rings;
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        for (auto& ring : trace_rings) rings.push_back(ring.get());
+    }
+
+    std::vector<std::pair<int, TraceEvent>> events;
+    for (TraceRing* ring : rings) {
+        for (const TraceEvent& event : ring->snapshot()) {
+            events.push_back({ring->thread, event});
+        }
+    }
+    return events;
+}
+
+static RenderTraceSummary _summarize(
+    const TraceRender& render,
+    const std::vector<std::pair<int, TraceEvent>>& events) {
+    RenderTraceSummary summary = {};
+    summary.render = render.id;
+    summary.ms = (render.end_ns - render.start_ns) / 1e6;
+
+    std::map<int, int64_t> busy;
+    int64_t busy_ns = 0;
+    for (const auto& [thread, event] : events) {
+        if (event.render != render.id) continue;
+        summary.sections++;
+        summary.pixels += event.pixels;
+        summary.escaped += event.escaped;
+        summary.iterations += event.iterations;
+        busy[thread] += event.end_ns - event.start_ns;
+        busy_ns += event.end_ns - event.start_ns;
+    }
+
+    int64_t max_busy_ns = 0;
+    for (const auto& [thread, ns] : busy) {
+        max_busy_ns = std::max(max_busy_ns, ns);
+    }
+
+    int threads = std::max(render.threads, (int)busy.size());
+    summary.busy_ms = busy_ns / 1e6;
+    summary.max_busy_ms = max_busy_ns / 1e6;
+    summary.idle_ms = std::max(threads * summary.ms - summary.busy_ms, 0.0);
+    summary.imbalance =
+        busy_ns > 0 ? (double)max_busy_ns * threads / busy_ns : 1.0;
+    return summary;
+}
+
+void RenderTrace::_finish(int threads) {
+    TraceRender render = {id, name, start_ns, trace_now_ns(), threads};
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        trace_renders.push_back(render);
+        if (trace_renders.size() > TRACE_MAX_RENDERS) {
+            trace_renders.erase(trace_renders.begin());
+        }
+    }
+
+    RenderTraceSummary summary = _summarize(render, _trace_events());
+    double seconds = std::max(summary.ms, 1e-3) / 1000.0;
+    std::cout << "trace: " << name << " " << summary.render << " took "
+              << summary.ms << " ms, " << summary.sections << " sections, "
+              << summary.pixels / seconds << " pixels/s, "
+              << summary.iterations / seconds << " iterations/s, "
+              << summary.escaped << " of " << summary.pixels
+              << " escaped, idle " << summary.idle_ms << " ms over "
+              << threads << " threads, imbalance " << summary.imbalance
+              << std::endl;
+}
+
+std::vector<RenderTraceSummary> trace_summaries() {
+    std::vector<TraceRender> renders;
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        renders = trace_renders;
+    }
+
+    auto events = _trace_events();
+    std::vector<RenderTraceSummary> summaries;
+    for (const TraceRender& render : renders) {
+        summaries.push_back(_summarize(render, events));
+    }
+    return summaries;
+}
+
+bool write_chrome_trace(const std::string& path) {
+    std::vector<TraceRender> renders;
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        renders = trace_renders;
+    }
+    auto events = _trace_events();
+
+    std::ofstream out(path);
+    if (!out) return false;
+    out << std::fixed << std::setprecision(3);
+
+    // times are in microseconds. renders go on thread 0, sections on the
+    // thread of their ring
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+        << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, "
+           "\"args\": {\"name\": \"renders\"}}";
+
+    for (const TraceRender& render : renders) {
+        RenderTraceSummary summary = _summarize(render, events);
+        out << ",\n{\"name\": \"" << render.name << " " << render.id
+            << "\", \"cat\": \"render\", \"ph\": \"X\", \"pid\": 1, "
+               "\"tid\": 0, \"ts\": "
+            << render.start_ns / 1e3 << ", \"dur\": "
+            << (render.end_ns - render.start_ns) / 1e3
+            << ", \"args\": {\"threads\": " << render.threads
+            << ", \"sections\": " << summary.sections
+            << ", \"pixels\": " << summary.pixels
+            << ", \"escaped\": " << summary.escaped
+            << ", \"iterations\": " << summary.iterations
+            << ", \"idle_ms\": " << summary.idle_ms
+            << ", \"imbalance\": " << summary.imbalance << "}}";
+    }
+
+    std::map<int, bool> named;
+    for (const auto& [thread, event] : events) {
+        if (!named[thread]) {
+            named[thread] = true;
+            out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                   "\"tid\": "
+                << thread << ", \"args\": {\"name\": \"render thread "
+                << thread << "\"}}";
+        }
+
+        const ComputeSection& s = event.section;
+        out << ",\n{\"name\": \"section\", \"cat\": \"section\", \"ph\": "
+               "\"X\", \"pid\": 1, \"tid\": "
+            << thread << ", \"ts\": " << event.start_ns / 1e3
+            << ", \"dur\": " << (event.end_ns - event.start_ns) / 1e3
+            << ", \"args\": {\"render\": " << event.render
+            << ", \"step\": " << event.step << ", \"x\": [" << s.start_x
+            << ", " << s.end_x << "], \"y\": [" << s.start_y << ", "
+            << s.end_y << "], \"pixels\": " << event.pixels
+            << ", \"escaped\": " << event.escaped
+            << ", \"iterations\": " << event.iterations << "}}";
+    }
+    out << "\n]}\n";
+    return (bool)out;
+}
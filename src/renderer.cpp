@@ -1,37 +1,98 @@
 #include "renderer.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <ostream>
 
+#include "gmp_allocator.hpp"
 #include "mandelbrot_renderer.hpp"
 #include "math.hpp"
+#include "perturbation_renderer.hpp"
+#include "simd_renderer.hpp"
 #include "thread_manager.hpp"
 
+// raises the mpfr precision of the calling thread to that mpfr_bounds is
+// stored at while in scope, so the temporaries of bound ops keep every bit of
+// the centre even after the view precision dropped again
+struct BoundsPrec {
+    mpfr_prec_t saved;
+
+    BoundsPrec(FractalBounds<mpfr_t>& bounds) : saved(MPFRMathFuncs::prec) {
+        MPFRMathFuncs::prec =
+            std::max(saved, mpfr_get_prec(bounds.x_min));
+    }
+    ~BoundsPrec() { MPFRMathFuncs::prec = saved; }
+};
+
 void Renderer::set_window_size_i(int width, int height) {
     mpfr_bounds.set_sizes_i<mpfr_math_funcs>(width, height);
     double_bounds.set_sizes_i<double_math_funcs>(width, height);
+    dd_bounds.set_sizes_i<dd_math_funcs>(width, height);
+    fp_bounds.set_sizes_i<fp_math_funcs>(width, height);
+    _update_tile_base();
 }
 
 void Renderer::init_bounds() {
     mpfr_bounds.init<mpfr_math_funcs>();
     double_bounds.init<double_math_funcs>();
+    dd_bounds.init<dd_math_funcs>();
+    fp_bounds.init<fp_math_funcs>();
 }
 
 void Renderer::set_fractal_bounds_d(double x_min, double x_max, double y_min,
                                     double y_max) {
     mpfr_bounds.set_bounds_d<mpfr_math_funcs>(x_min, x_max, y_min, y_max);
     double_bounds.set_bounds_d<double_math_funcs>(x_min, x_max, y_min, y_max);
+    dd_bounds.set_bounds_d<dd_math_funcs>(x_min, x_max, y_min, y_max);
+    fp_bounds.set_bounds_d<fp_math_funcs>(x_min, x_max, y_min, y_max);
+    _update_tile_base();
+}
+
+void Renderer::_update_tile_base() {
+    ScratchFrame<mpfr_t, mpfr_math_funcs> scratch;
+    mpfr_t& dx = scratch.get();
+    mpfr_t& dy = scratch.get();
+    _pixel_spacing<mpfr_t, mpfr_math_funcs>(mpfr_bounds, dx, dy);
+    mpfr_set(tile_base, dx, MPFR_RNDN);
+
+    // tiles of another start view are on another grid
+    tiles.clear();
 }
 
 void Renderer::bound_zoom(double zoom_factor) {
+    // the running job renders a view that is gone now
+    cancel_render();
+
     mpfr_mul_d(zoom_level, zoom_level, zoom_factor, MPFR_RNDN);
 
-    arb_bound_zoom<mpfr_t, mpfr_math_funcs>(mpfr_bounds, zoom_factor);
-    arb_bound_zoom<double, double_math_funcs>(double_bounds, zoom_factor);
+    {
+        BoundsPrec bounds_prec(mpfr_bounds);
+        arb_bound_zoom<mpfr_t, mpfr_math_funcs>(mpfr_bounds, zoom_factor);
+    }
+
+    // raised after every step, the guard bits cover the zoom itself
+    update_precision();
+    _sync_bounds();
 }
 
 void Renderer::bound_move(int wx, int wy) {
-    arb_move_bound_windowed<mpfr_t, mpfr_math_funcs>(mpfr_bounds, wx, wy);
-    arb_move_bound_windowed<double, double_math_funcs>(double_bounds, wx, wy);
+    cancel_render();
+
+    {
+        BoundsPrec bounds_prec(mpfr_bounds);
+        arb_move_bound_windowed<mpfr_t, mpfr_math_funcs>(mpfr_bounds, wx, wy);
+    }
+    _sync_bounds();
+}
+
+void Renderer::_sync_bounds() {
+    arb_set_bounds_mpfr<double, double_math_funcs>(double_bounds, mpfr_bounds);
+    arb_set_bounds_mpfr<DoubleDouble, dd_math_funcs>(dd_bounds, mpfr_bounds);
+    arb_set_bounds_mpfr<FixedPoint<FIXED_POINT_LIMBS>, fp_math_funcs>(
+        fp_bounds, mpfr_bounds);
 }
 
 void Renderer::window_get_bounds(double& x1, double& y1, double& x2,
@@ -45,7 +106,9 @@ void Renderer::window_get_bounds(double& x1, double& y1, double& x2,
         case MathType::FLOAT: {
             break;
         }
-        case MathType::MPFR: {
+        case MathType::MPFR:
+        case MathType::PERTURBATION:
+        case MathType::BLA: {
             get_windowed_bound_rect<mpfr_t, mpfr_math_funcs>(mpfr_bounds, x1,
                                                              y1, x2, y2);
             break;
@@ -53,6 +116,16 @@ void Renderer::window_get_bounds(double& x1, double& y1, double& x2,
         case MathType::MPQ: {
             break;
         }
+        case MathType::DOUBLE_DOUBLE: {
+            get_windowed_bound_rect<DoubleDouble, dd_math_funcs>(
+                dd_bounds, x1, y1, x2, y2);
+            break;
+        }
+        case MathType::FIXED_POINT: {
+            get_windowed_bound_rect<FixedPoint<FIXED_POINT_LIMBS>,
+                                    fp_math_funcs>(fp_bounds, x1, y1, x2, y2);
+            break;
+        }
     }
 }
 
@@ -62,8 +135,187 @@ void Renderer::resize_pixels(int width, int height) {
 
 void Renderer::set_math_type(MathType _type) { type = _type; }
 
-void Renderer::render_mandelbrot(int res, int n_threads) {
-    std::cout << "rendering mandelbrot...\n";
+void Renderer::recolor() {
+    std::lock_guard<std::mutex> lock(recolor_mutex);
+    colorize(iteration_buffer, palette, pixels, threads);
+}
+
+void Renderer::set_palette(PaletteMode mode) {
+    palette = mode;
+    if (job && !job->done()) return;
+
+    // speculation may hold the pool, the job thread recolors once it stopped
+    // and speculates on from there
+    for (auto& speculative : speculative_jobs) speculative->cancel();
+    speculative_jobs = _speculative_jobs(true);
+    _start_job_thread([this, next = speculative_jobs] {
+        recolor();
+        _speculate(next);
+    });
+}
+
+// bits between the largest coordinate of the view and the pixel spacing, the
+// part of the mantissa that tells neighbouring pixels apart
+int Renderer::required_bits(FractalBounds<mpfr_t>& bounds) {
+    ScratchFrame<mpfr_t, mpfr_math_funcs> scratch;
+    mpfr_t& spacing_x = scratch.get();
+    mpfr_t& spacing_y = scratch.get();
+
+    mpfr_math_funcs.sub(spacing_x, bounds.x_max, bounds.x_min);
+    mpfr_math_funcs.div(spacing_x, spacing_x, bounds.width);
+    mpfr_math_funcs.sub(spacing_y, bounds.y_max, bounds.y_min);
+    mpfr_math_funcs.div(spacing_y, spacing_y, bounds.height);
+
+    long exp_x, exp_y;
+    mpfr_get_d_2exp(&exp_x, spacing_x, MPFR_RNDN);
+    mpfr_get_d_2exp(&exp_y, spacing_y, MPFR_RNDN);
+
+    double coord = std::max({std::abs(bounds.d_x_min),
+                             std::abs(bounds.d_x_max),
+                             std::abs(bounds.d_y_min),
+                             std::abs(bounds.d_y_max), 2.0});
+    int coord_exp;
+    std::frexp(coord, &coord_exp);
+
+    return coord_exp - (int)std::min(exp_x, exp_y);
+}
+
+// cheapest engine that still resolves the pixels of a view needing bits
+MathType Renderer::pick_math_type(int bits) {
+    if (bits <= AUTO_DOUBLE_BITS) return MathType::DOUBLE;
+    if (bits <= AUTO_DOUBLE_DOUBLE_BITS) return MathType::DOUBLE_DOUBLE;
+    if (bits <= AUTO_FIXED_POINT_BITS) return MathType::FIXED_POINT;
+    return MathType::BLA;
+}
+
+// sets the mpfr precision to what the view needs and raises mpfr_bounds to
+// it. the bounds are never rounded down, zooming back out keeps a deep centre.
+// with auto_math_type also picks the engine
+void Renderer::update_precision() {
+    int bits = required_bits(mpfr_bounds);
+
+    mpfr_prec_t prec = bits + MPFR_PREC_GUARD_BITS;
+    prec = std::max<mpfr_prec_t>((prec + 63) / 64 * 64, MPFR_MIN_PREC);
+
+    if (prec != MPFRMathFuncs::prec) _set_precision(prec);
+
+    if (auto_math_type) {
+        MathType picked = pick_math_type(bits);
+        if (picked != type) {
+            type = picked;
+            std::cout << "math type: " << math_type_name(type) << std::endl;
+        }
+    }
+}
+
+void Renderer::_set_precision(mpfr_prec_t prec) {
+    mpfr_t* values[] = {
+        &mpfr_bounds.x_min,   &mpfr_bounds.x_max,   &mpfr_bounds.y_min,
+        &mpfr_bounds.y_max,   &mpfr_bounds.r_x_min, &mpfr_bounds.r_x_max,
+        &mpfr_bounds.r_y_min, &mpfr_bounds.r_y_max, &mpfr_bounds.width,
+        &mpfr_bounds.height};
+    // raising is exact
+    for (mpfr_t* value : values) {
+        if (mpfr_get_prec(*value) < prec) {
+            mpfr_prec_round(*value, prec, MPFR_RNDN);
+        }
+    }
+
+    MPFRMathFuncs::prec = prec;
+    std::cout << "mpfr precision: " << prec << " bits" << std::endl;
+}
+
+bool Renderer::set_view(const std::string& center_x,
+                        const std::string& center_y,
+                        const std::string& zoom) {
+    cancel_render();
+
+    mpfr_t magnification;
+    mpfr_init2(magnification, MPFR_MIN_PREC);
+    if (mpfr_set_str(magnification, zoom.c_str(), 10, MPFR_RNDN) != 0 ||
+        !(mpfr_sgn(magnification) > 0)) {
+        mpfr_clear(magnification);
+        return false;
+    }
+
+    // bits of the zoom, the pixels across and the integer part of the
+    // coordinates, update_precision below settles on the exact count
+    long exp;
+    mpfr_get_d_2exp(&exp, magnification, MPFR_RNDN);
+    mpfr_prec_t prec = std::max<long>(exp, 0) +
+                       std::bit_width((unsigned)mpfr_bounds.i_width) + 4 +
+                       MPFR_PREC_GUARD_BITS;
+    prec = std::max<mpfr_prec_t>((prec + 63) / 64 * 64, MPFR_MIN_PREC);
+    if (prec > MPFRMathFuncs::prec) _set_precision(prec);
+
+    {
+        BoundsPrec bounds_prec(mpfr_bounds);
+        ScratchFrame<mpfr_t, mpfr_math_funcs> scratch;
+        mpfr_t& cx = scratch.get();
+        mpfr_t& cy = scratch.get();
+        mpfr_t& half_w = scratch.get();
+        mpfr_t& half_h = scratch.get();
+        bool parsed = mpfr_set_str(cx, center_x.c_str(), 10, MPFR_RNDN) == 0 &&
+                      mpfr_set_str(cy, center_y.c_str(), 10, MPFR_RNDN) == 0;
+        if (!parsed) {
+            mpfr_clear(magnification);
+            return false;
+        }
+
+        // half_w = ZOOM_1_VIEW_WIDTH / 2 / zoom, half_h from the aspect ratio
+        mpfr_set_d(half_w, ZOOM_1_VIEW_WIDTH / 2, MPFR_RNDN);
+        mpfr_div(half_w, half_w, magnification, MPFR_RNDN);
+        mpfr_mul(half_h, half_w, mpfr_bounds.height, MPFR_RNDN);
+        mpfr_div(half_h, half_h, mpfr_bounds.width, MPFR_RNDN);
+
+        mpfr_sub(mpfr_bounds.x_min, cx, half_w, MPFR_RNDN);
+        mpfr_add(mpfr_bounds.x_max, cx, half_w, MPFR_RNDN);
+        mpfr_sub(mpfr_bounds.y_min, cy, half_h, MPFR_RNDN);
+        mpfr_add(mpfr_bounds.y_max, cy, half_h, MPFR_RNDN);
+        mpfr_bounds.update_aux<mpfr_math_funcs>();
+    }
+
+    mpfr_set(zoom_level, magnification, MPFR_RNDN);
+    mpfr_clear(magnification);
+
+    update_precision();
+    _sync_bounds();
+    return true;
+}
+
+std::shared_ptr<RenderJob> Renderer::render_async(int res, int n_threads) {
+    cancel_render();
+
+    update_precision();
+
+    // before the checks below, a snapped view matches the last one exactly
+    TileGrid grid;
+    bool tiled = TILE_CACHE && tiling && _snap_tile_grid(mpfr_bounds, grid);
+    if (tiled) _sync_bounds();
+
+    // iteration_buffer holds the last job's view if it ran to the end, with
+    // the same settings. one still stopping is not waited for
+    bool reuse = job && job->done() && job->completed &&
+                 job->series_approximation == series_approximation &&
+                 job->subdivision == subdivision;
+    size_t resume_from = 0;
+    bool pan = false;
+    int pan_x = 0, pan_y = 0;
+    if (RESUMABLE_ITERATION && reuse && iterations > job->iterations &&
+        _same_view(*job)) {
+        resume_from = job->iterations;
+    } else if (reuse && iterations == job->iterations) {
+        // before update_rendered, the snapped view is what gets rendered
+        pan = _pan_offset(*job, pan_x, pan_y);
+    }
+
+    // the preview rect is drawn relative to the view of the last render
+    mpfr_bounds.update_rendered<mpfr_math_funcs>();
+    double_bounds.update_rendered<double_math_funcs>();
+    dd_bounds.update_rendered<dd_math_funcs>();
+    fp_bounds.update_rendered<fp_math_funcs>();
+
+    std::cout << "rendering mandelbrot (" << math_type_name(type) << ")...\n";
     std::cout << "current zoom level: ";
     mpfr_exp_t exp;
     char* buf = mpfr_get_str(NULL, &exp, 10, 5, zoom_level, MPFR_RNDN);
@@ -71,28 +323,593 @@ void Renderer::render_mandelbrot(int res, int n_threads) {
     mpfr_free_str(buf);
     std::cout << "num iterations: " << iterations << std::endl;
 
+    job = std::make_shared<RenderJob>(*this, res);
+    job->resume_from = resume_from;
+    job->pan = pan;
+    job->pan_x = pan_x;
+    job->pan_y = pan_y;
+    job->tiled = tiled;
+    job->grid = std::move(grid);
+    // the views around the one rendered now, the window has no other yet
+    speculative_jobs = _speculative_jobs(false);
+    _start_job_thread([this, n_threads, job = job, next = speculative_jobs] {
+        // the pool is only resized between runs
+        threads.set_threads(n_threads);
+        _render_job(*job);
+        job->_finish();
+        if (job->completed) _speculate(next);
+    });
+    return job;
+}
+
+void Renderer::speculate() {
+    cancel_render();
+
+    speculative_jobs = _speculative_jobs(true);
+    if (speculative_jobs.empty()) return;
+    _start_job_thread([this, next = speculative_jobs] { _speculate(next); });
+}
+
+void Renderer::cancel_render() {
+    if (job) job->cancel();
+    for (auto& speculative : speculative_jobs) speculative->cancel();
+}
+
+void Renderer::_start_job_thread(std::function<void()> run) {
+    // the key handlers do not wait for the cancelled job to notice, the new
+    // thread does
+    job_thread = std::thread(
+        [last = std::move(job_thread), run = std::move(run)]() mutable {
+            if (last.joinable()) last.join();
+            run();
+        });
+}
+
+void Renderer::render_mandelbrot(int res, int n_threads) {
+    render_async(res, n_threads)->wait();
+}
+
+bool Renderer::_same_view(RenderJob& last) {
+    if (last.type != type) return false;
+
     switch (type) {
+        case MathType::DOUBLE:
+            return double_bounds.same_view<double_math_funcs>(
+                last.double_bounds);
+        case MathType::MPFR:
+            // the packed z of the last job has its precision
+            return last.prec == MPFRMathFuncs::prec &&
+                   mpfr_bounds.same_view<mpfr_math_funcs>(last.mpfr_bounds);
+        case MathType::DOUBLE_DOUBLE:
+            return dd_bounds.same_view<dd_math_funcs>(last.dd_bounds);
+        case MathType::FIXED_POINT:
+            return fp_bounds.same_view<fp_math_funcs>(last.fp_bounds);
+        default:
+            // perturbation keeps no z to go on from
+            return false;
+    }
+}
+
+bool Renderer::_snap_tile_grid(FractalBounds<mpfr_t>& bounds,
+                               TileGrid& grid) {
+    int width = bounds.i_width, height = bounds.i_height;
+    if (width <= 0 || height <= 0 || !(mpfr_sgn(tile_base) > 0)) return false;
+
+    BoundsPrec bounds_prec(bounds);
+    ScratchFrame<mpfr_t, mpfr_math_funcs> scratch;
+    mpfr_t& dx = scratch.get();
+    mpfr_t& dy = scratch.get();
+    mpfr_t& spacing = scratch.get();
+    mpfr_t& tmp = scratch.get();
+    _pixel_spacing<mpfr_t, mpfr_math_funcs>(bounds, dx, dy);
+
+    // zoom step of the view, log2 in two parts since deep views are far
+    // beyond the exponent range of a double
+    long exp;
+    mpfr_div(tmp, tile_base, dx, MPFR_RNDN);
+    double mantissa = mpfr_get_d_2exp(&exp, tmp, MPFR_RNDN);
+    if (!(mantissa > 0.0)) return false;
+    int zoom = (int)std::lround((std::log2(mantissa) + (double)exp) /
+                                std::log2(ZOOM_STEP));
+
+    // spacing = tile_base / ZOOM_STEP^zoom
+    mpfr_set_d(spacing, ZOOM_STEP, MPFR_RNDN);
+    mpfr_pow_si(spacing, spacing, zoom, MPFR_RNDN);
+    mpfr_div(spacing, tile_base, spacing, MPFR_RNDN);
+
+    for (mpfr_t* d : {&dx, &dy}) {
+        mpfr_div(tmp, *d, spacing, MPFR_RNDN);
+        mpfr_sub_d(tmp, tmp, 1.0, MPFR_RNDN);
+        double off = mpfr_get_d(tmp, MPFR_RNDN);
+        if (!(std::abs(off) <= TILE_SCALE_TOLERANCE)) return false;
+    }
+
+    // pixel x, y of the snapped view is pixel gx + x, gy + y of the grid,
+    // with rows counting down from the real axis
+    mpz_t gx, gy, q;
+    mpz_init(gx);
+    mpz_init(gy);
+    mpz_init(q);
+
+    mpfr_div(tmp, bounds.x_min, spacing, MPFR_RNDN);
+    mpfr_get_z(gx, tmp, MPFR_RNDN);
+    mpfr_div(tmp, bounds.y_max, spacing, MPFR_RNDN);
+    mpfr_neg(tmp, tmp, MPFR_RNDN);
+    mpfr_get_z(gy, tmp, MPFR_RNDN);
+
+    // x_min = gx * spacing, x_max = (gx + width) * spacing
+    mpfr_set_z(tmp, gx, MPFR_RNDN);
+    mpfr_mul(bounds.x_min, tmp, spacing, MPFR_RNDN);
+    mpz_add_ui(q, gx, width);
+    mpfr_set_z(tmp, q, MPFR_RNDN);
+    mpfr_mul(bounds.x_max, tmp, spacing, MPFR_RNDN);
+
+    // y_max = -gy * spacing, y_min = -(gy + height) * spacing
+    mpfr_set_z(tmp, gy, MPFR_RNDN);
+    mpfr_mul(bounds.y_max, tmp, spacing, MPFR_RNDN);
+    mpfr_neg(bounds.y_max, bounds.y_max, MPFR_RNDN);
+    mpz_add_ui(q, gy, height);
+    mpfr_set_z(tmp, q, MPFR_RNDN);
+    mpfr_mul(bounds.y_min, tmp, spacing, MPFR_RNDN);
+    mpfr_neg(bounds.y_min, bounds.y_min, MPFR_RNDN);
+
+    bounds.update_aux<mpfr_math_funcs>();
+
+    // tile columns from floor(gx / TILE_SIZE), rows from floor(gy / TILE_SIZE)
+    auto tile_names = [&q](mpz_t g, int size, int& off,
+                           std::vector<std::string>& names) {
+        off = (int)mpz_fdiv_q_ui(q, g, TILE_SIZE);
+        names.clear();
+        for (int i = 0; i * TILE_SIZE < off + size; i++) {
+            // buffer from mpz_sizeinbase, the string of mpz_get_str would
+            // have to be freed through the gmp allocator
+            std::string name(mpz_sizeinbase(q, 16) + 2, '\0');
+            mpz_get_str(name.data(), 16, q);
+            name.resize(std::strlen(name.c_str()));
+            names.push_back(std::move(name));
+            mpz_add_ui(q, q, 1);
+        }
+    };
+    grid.zoom = zoom;
+    tile_names(gx, width, grid.off_x, grid.cols);
+    tile_names(gy, height, grid.off_y, grid.rows);
+
+    mpz_clear(gx);
+    mpz_clear(gy);
+    mpz_clear(q);
+    return true;
+}
+
+bool Renderer::_assemble_tiles(RenderJob& job,
+                               std::vector<ComputeSection>& exposed) {
+    const TileGrid& grid = job.grid;
+    int width = job.mpfr_bounds.i_width, height = job.mpfr_bounds.i_height;
+
+    iteration_buffer.resize(width, height, SMOOTH_ITERATIONS);
+    iteration_buffer.iterations = job.iterations;
+    iteration_buffer.resume.clear();
+
+    exposed.clear();
+    int hits = 0;
+    for (int j = 0; j < (int)grid.rows.size(); j++) {
+        for (int i = 0; i < (int)grid.cols.size(); i++) {
+            int x = i * TILE_SIZE - grid.off_x, y = j * TILE_SIZE - grid.off_y;
+            ComputeSection section = {std::max(x, 0),
+                                      std::min(x + TILE_SIZE, width),
+                                      std::max(y, 0),
+                                      std::min(y + TILE_SIZE, height)};
+
+            // tiles cut by the edge of the view are always rendered
+            bool whole = x >= 0 && y >= 0 && x + TILE_SIZE <= width &&
+                         y + TILE_SIZE <= height;
+            std::shared_ptr<const Tile> tile;
+            if (whole) {
+                tile = tiles.find(grid.key(i, j, job.iterations,
+                                           job.engine_key()));
+            }
+            if (!tile) {
+                exposed.push_back(section);
+                continue;
+            }
+
+            tile->paste(iteration_buffer, x, y);
+            hits++;
+            // cached pixels at the limit have no z to go on from
+            if constexpr (RESUMABLE_ITERATION) {
+                for (int ty = y; ty < y + TILE_SIZE; ty++) {
+                    for (int tx = x; tx < x + TILE_SIZE; tx++) {
+                        uint32_t index = ty * width + tx;
+                        if (iteration_buffer.iters[index] ==
+                            job.iterations) {
+                            iteration_buffer.resume.restart.push_back(index);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    TileCacheStats stats = tiles.stats();
+    std::cout << "tiles: " << hits << " cached, " << exposed.size()
+              << " rendered (" << stats.hits << " hits, " << stats.misses
+              << " misses, " << stats.tiles << " tiles in "
+              << (stats.bytes >> 20) << " MiB cached)" << std::endl;
+    return hits > 0;
+}
+
+void Renderer::_store_tiles(RenderJob& job) {
+    const TileGrid& grid = job.grid;
+    int width = iteration_buffer.width, height = iteration_buffer.height;
+
+    for (int j = 0; j < (int)grid.rows.size(); j++) {
+        for (int i = 0; i < (int)grid.cols.size(); i++) {
+            int x = i * TILE_SIZE - grid.off_x, y = j * TILE_SIZE - grid.off_y;
+            if (x < 0 || y < 0 || x + TILE_SIZE > width ||
+                y + TILE_SIZE > height) {
+                continue;
+            }
+
+            TileKey key = grid.key(i, j, job.iterations, job.engine_key());
+            if (tiles.contains(key)) continue;
+            tiles.insert(key, Tile::cut(iteration_buffer, x, y));
+        }
+    }
+}
+
+std::vector<std::shared_ptr<RenderJob>> Renderer::_speculative_jobs(
+    bool current) {
+    std::vector<std::shared_ptr<RenderJob>> jobs;
+    if (!TILE_CACHE || !tiling || !speculation) return jobs;
+
+    // the view itself first, it is what enter renders next
+    std::vector<double> zooms = {ZOOM_STEP, 1.0 / ZOOM_STEP};
+    if (current) zooms.insert(zooms.begin(), 1.0);
+
+    for (double zoom : zooms) {
+        auto speculative = std::make_shared<RenderJob>(*this, 1);
+        RenderJob& s = *speculative;
+        if (zoom != 1.0) {
+            BoundsPrec bounds_prec(s.mpfr_bounds);
+            arb_zoom_bounds<mpfr_t, mpfr_math_funcs>(s.mpfr_bounds, zoom);
+        }
+        if (!_snap_tile_grid(s.mpfr_bounds, s.grid)) continue;
+
+        arb_set_bounds_mpfr<double, double_math_funcs>(s.double_bounds,
+                                                       s.mpfr_bounds);
+        arb_set_bounds_mpfr<DoubleDouble, dd_math_funcs>(s.dd_bounds,
+                                                         s.mpfr_bounds);
+        arb_set_bounds_mpfr<FixedPoint<FIXED_POINT_LIMBS>, fp_math_funcs>(
+            s.fp_bounds, s.mpfr_bounds);
+        // the engine a render of the view will pick, tiles are per engine
+        if (auto_math_type) {
+            s.type = pick_math_type(required_bits(s.mpfr_bounds));
+        }
+        s.tiled = true;
+        jobs.push_back(std::move(speculative));
+    }
+    return jobs;
+}
+
+void Renderer::_speculate(
+    const std::vector<std::shared_ptr<RenderJob>>& jobs) {
+    for (const auto& speculative : jobs) {
+        RenderJob& job = *speculative;
+        if (job.cancelled()) return;
+        MPFRMathFuncs::prec = job.prec;
+
+        const TileGrid& grid = job.grid;
+        int width = job.mpfr_bounds.i_width, height = job.mpfr_bounds.i_height;
+
+        // whole tiles only, the cut ones are never taken from the cache
+        std::vector<ComputeSection> missing;
+        std::vector<TileKey> keys;
+        for (int j = 0; j < (int)grid.rows.size(); j++) {
+            for (int i = 0; i < (int)grid.cols.size(); i++) {
+                int x = i * TILE_SIZE - grid.off_x;
+                int y = j * TILE_SIZE - grid.off_y;
+                if (x < 0 || y < 0 || x + TILE_SIZE > width ||
+                    y + TILE_SIZE > height) {
+                    continue;
+                }
+
+                TileKey key = grid.key(i, j, job.iterations, job.engine_key());
+                if (tiles.contains(key)) continue;
+                missing.push_back({x, x + TILE_SIZE, y, y + TILE_SIZE});
+                keys.push_back(std::move(key));
+            }
+        }
+        if (missing.empty()) continue;
+
+        std::cout << "speculative render of " << missing.size()
+                  << " tiles at zoom step " << grid.zoom << " ("
+                  << math_type_name(job.type) << ")" << std::endl;
+
+        speculative_buffer.resize(width, height, SMOOTH_ITERATIONS);
+        speculative_buffer.iterations = job.iterations;
+        speculative_buffer.resume.clear();
+        // every tile goes into the cache as soon as it is done, a cancel
+        // only loses the ones still running
+        job.progress.on_section = [&](size_t k) {
+            tiles.insert(keys[k],
+                         Tile::cut(speculative_buffer, missing[k].start_x,
+                                   missing[k].start_y));
+        };
+        _render_sections(job, speculative_buffer, &missing);
+        if (job.cancelled()) return;
+    }
+}
+
+bool Renderer::_pan_offset(RenderJob& last, int& kx, int& ky) {
+    if (last.type != type) return false;
+
+    switch (type) {
+        case MathType::DOUBLE:
+            return arb_pixel_offset<double, double_math_funcs>(
+                double_bounds, last.double_bounds, kx, ky);
+        case MathType::MPFR:
+            // the kept resume list is packed at the last precision
+            return last.prec == MPFRMathFuncs::prec &&
+                   arb_pixel_offset<mpfr_t, mpfr_math_funcs>(
+                       mpfr_bounds, last.mpfr_bounds, kx, ky);
+        case MathType::PERTURBATION:
+        case MathType::BLA:
+            // no resume list, the shifted pixels are final at any precision
+            return arb_pixel_offset<mpfr_t, mpfr_math_funcs>(
+                mpfr_bounds, last.mpfr_bounds, kx, ky);
+        case MathType::DOUBLE_DOUBLE:
+            return arb_pixel_offset<DoubleDouble, dd_math_funcs>(
+                dd_bounds, last.dd_bounds, kx, ky);
+        case MathType::FIXED_POINT:
+            return arb_pixel_offset<FixedPoint<FIXED_POINT_LIMBS>,
+                                    fp_math_funcs>(fp_bounds, last.fp_bounds,
+                                                   kx, ky);
+        default:
+            return false;
+    }
+}
+
+void Renderer::_render_job(RenderJob& job) {
+    MPFRMathFuncs::prec = job.prec;
+    // coarse passes show up while the finer ones run
+    job.progress.on_pass = [this] { recolor(); };
+
+    gmp_allocator_reset_stats();
+    auto start = std::chrono::steady_clock::now();
+
+    if (job.resume_from > 0) {
+        _resume_job(job);
+    } else {
+        _render_job_full(job);
+    }
+
+    std::chrono::duration<double, std::milli> took =
+        std::chrono::steady_clock::now() - start;
+    job.took_ms = took.count();
+    if (job.cancelled()) {
+        std::cout << "render cancelled after " << took.count() << " ms"
+                  << std::endl;
+        return;
+    }
+    job.completed = true;
+    // the palette may have changed during the last pass
+    recolor();
+    if (job.tiled) _store_tiles(job);
+    std::cout << "render took " << took.count() << " ms" << std::endl;
+
+    if (gmp_allocator_installed()) {
+        GMPAllocStats stats = gmp_allocator_stats();
+        std::cout << "gmp allocations: " << stats.allocs << " (" << stats.bytes
+                  << " bytes)" << std::endl;
+    }
+}
+
+void Renderer::_resume_job(RenderJob& job) {
+    size_t iterations = job.iterations;
+    RenderProgress& progress = job.progress;
+
+    switch (job.type) {
         case MathType::DOUBLE: {
-            _render_fractal<
-                double, double_math_funcs,
-                _mandelbrot_section_renderer<double, double_math_funcs> >(
-                double_bounds, res, n_threads, iterations, pixels);
+            _resume_fractal<double, double_math_funcs>(
+                job.double_bounds, threads, progress, iterations,
+                iteration_buffer);
+            break;
+        }
+        case MathType::MPFR: {
+            _resume_fractal<mpfr_t, mpfr_math_funcs>(
+                job.mpfr_bounds, threads, progress, iterations,
+                iteration_buffer);
+            break;
+        }
+        case MathType::DOUBLE_DOUBLE: {
+            _resume_fractal<DoubleDouble, dd_math_funcs>(
+                job.dd_bounds, threads, progress, iterations,
+                iteration_buffer);
+            break;
+        }
+        case MathType::FIXED_POINT: {
+            _resume_fractal<FixedPoint<FIXED_POINT_LIMBS>, fp_math_funcs>(
+                job.fp_bounds, threads, progress, iterations,
+                iteration_buffer);
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+}
+
+void Renderer::_render_job_full(RenderJob& job) {
+    // a pan keeps what is still in view and renders the strips shifted in
+    std::vector<ComputeSection> exposed_sections;
+    std::vector<ComputeSection>* exposed = nullptr;
+    if (job.pan) {
+        iteration_buffer.shift(job.pan_x, -job.pan_y);
+        recolor();
+
+        ComputePool<double, double_math_funcs> pool;
+        pool.create_exposed_sections(iteration_buffer.width,
+                                     iteration_buffer.height, job.pan_x,
+                                     -job.pan_y);
+        exposed_sections = std::move(pool.sections);
+        exposed = &exposed_sections;
+
+        std::cout << "pan by " << job.pan_x << ", " << job.pan_y
+                  << " pixels, rendering " << _sections_area(exposed_sections)
+                  << " of them" << std::endl;
+        if (exposed_sections.empty()) return;
+    } else if (job.tiled && _assemble_tiles(job, exposed_sections)) {
+        exposed = &exposed_sections;
+        recolor();
+        if (exposed_sections.empty()) return;
+    }
+
+    _render_sections(job, iteration_buffer, exposed);
+}
+
+void Renderer::_render_sections(RenderJob& job, IterationBuffer& out,
+                                const std::vector<ComputeSection>* exposed) {
+    int res = job.res;
+    size_t iterations = job.iterations;
+    bool series_approximation = job.series_approximation;
+    RenderProgress& progress = job.progress;
+
+    switch (job.type) {
+        case MathType::DOUBLE: {
+            std::cout << "simd kernel: " << _simd_kernel_name() << std::endl;
+            _render_fractal<double, double_math_funcs, _simd_section_renderer>(
+                job.double_bounds, res, threads, progress, iterations,
+                out, exposed);
             break;
         }
         case MathType::FLOAT: {
             break;
         }
         case MathType::MPFR: {
-            _render_fractal<
-                mpfr_t, mpfr_math_funcs,
-                _mandelbrot_section_renderer<mpfr_t, mpfr_math_funcs> >(
-                mpfr_bounds, res, n_threads, iterations, pixels);
+            if (job.subdivision) {
+                _render_fractal<
+                    mpfr_t, mpfr_math_funcs,
+                    _subdivision_section_renderer<mpfr_t, mpfr_math_funcs> >(
+                    job.mpfr_bounds, res, threads, progress, iterations,
+                    out, exposed);
+            } else {
+                _render_fractal<
+                    mpfr_t, mpfr_math_funcs,
+                    _mandelbrot_section_renderer<mpfr_t, mpfr_math_funcs> >(
+                    job.mpfr_bounds, res, threads, progress, iterations,
+                    out, exposed);
+            }
             break;
         }
         case MathType::MPQ: {
             break;
         }
+        case MathType::PERTURBATION: {
+            _render_perturbation<mpfr_t, mpfr_math_funcs, _perturbation_pixel>(
+                job.mpfr_bounds, res, threads, progress, iterations,
+                series_approximation, out, exposed, &references);
+            break;
+        }
+        case MathType::BLA: {
+            _render_perturbation<mpfr_t, mpfr_math_funcs, _bla_pixel>(
+                job.mpfr_bounds, res, threads, progress, iterations,
+                series_approximation, out, exposed, &references);
+            break;
+        }
+        case MathType::DOUBLE_DOUBLE: {
+            if (job.subdivision) {
+                _render_fractal<
+                    DoubleDouble, dd_math_funcs,
+                    _subdivision_section_renderer<DoubleDouble, dd_math_funcs> >(
+                    job.dd_bounds, res, threads, progress, iterations,
+                    out, exposed);
+            } else {
+                _render_fractal<
+                    DoubleDouble, dd_math_funcs,
+                    _mandelbrot_section_renderer<DoubleDouble, dd_math_funcs> >(
+                    job.dd_bounds, res, threads, progress, iterations,
+                    out, exposed);
+            }
+            break;
+        }
+        case MathType::FIXED_POINT: {
+            using FP = FixedPoint<FIXED_POINT_LIMBS>;
+            if (job.subdivision) {
+                _render_fractal<
+                    FP, fp_math_funcs,
+                    _subdivision_section_renderer<FP, fp_math_funcs> >(
+                    job.fp_bounds, res, threads, progress, iterations,
+                    out, exposed);
+            } else {
+                _render_fractal<
+                    FP, fp_math_funcs,
+                    _mandelbrot_section_renderer<FP, fp_math_funcs> >(
+                    job.fp_bounds, res, threads, progress, iterations,
+                    out, exposed);
+            }
+            break;
+        }
     }
 }
 
-Renderer::Renderer() { mpfr_init_set_si(zoom_level, 1, MPFR_RNDN); }
+Renderer::Renderer() {
+    // before the first mpfr allocation, memory from malloc cannot be freed
+    // through the pools
+    if (GMP_POOL_ALLOCATOR) {
+        gmp_allocator_install();
+    }
+    mpfr_init_set_si(zoom_level, 1, MPFR_RNDN);
+    mpfr_init2(tile_base, START_MPFR_PREC);
+    mpfr_set_si(tile_base, 0, MPFR_RNDN);
+}
+
+Renderer::~Renderer() {
+    cancel_render();
+    if (job_thread.joinable()) job_thread.join();
+}
+
+RenderJob::RenderJob(Renderer& renderer, int _res)
+    : type(renderer.type),
+      iterations(renderer.iterations),
+      series_approximation(renderer.series_approximation),
+      subdivision(renderer.subdivision),
+      res(_res),
+      prec(MPFRMathFuncs::prec) {
+    // an exact copy, views compare equal to it until they change
+    {
+        BoundsPrec bounds_prec(renderer.mpfr_bounds);
+        mpfr_bounds.init_copy<Renderer::mpfr_math_funcs>(renderer.mpfr_bounds);
+    }
+    double_bounds.init_copy<Renderer::double_math_funcs>(
+        renderer.double_bounds);
+    dd_bounds.init_copy<Renderer::dd_math_funcs>(renderer.dd_bounds);
+    fp_bounds.init_copy<Renderer::fp_math_funcs>(renderer.fp_bounds);
+}
+
+RenderJob::~RenderJob() {
+    mpfr_bounds.clear<Renderer::mpfr_math_funcs>();
+    double_bounds.clear<Renderer::double_math_funcs>();
+    dd_bounds.clear<Renderer::dd_math_funcs>();
+    fp_bounds.clear<Renderer::fp_math_funcs>();
+}
+
+double RenderJob::get_progress() const {
+    if (progress.pixels_total == 0) return 0.0;
+    return (double)progress.pixels_done.load(std::memory_order_relaxed) /
+           (double)progress.pixels_total;
+}
+
+bool RenderJob::done() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return finished;
+}
+
+void RenderJob::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished_cv.wait(lock, [this] { return finished; });
+}
+
+void RenderJob::_finish() {
+    std::lock_guard<std::mutex> lock(mutex);
+    finished = true;
+    finished_cv.notify_all();
+}
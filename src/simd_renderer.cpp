@@ -0,0 +1,316 @@
+#include "simd_renderer.hpp"
+
+#include <algorithm>
+
+#include "mandelbrot_renderer.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define XFRACTAL_X86
+#endif
+
+// widest lane group of any kernel
+constexpr int SIMD_MAX_LANES = 8;
+
+constexpr DoubleMathFuncs double_math_funcs{};
+
+// every kernel iterates like _mandelbrot_section_renderer with the same
+// operation order. where the target has fma the compiler may contract the
+// multiply-adds, which only changes the last bit of chaotic pixels
+
+static void _mandelbrot_row_scalar(int iterations, const double* cx,
+                                   double cy, int count, int* out_iters,
+                                   double* out_z, double* out_mag) {
+    for (int i = 0; i < count; i++) {
+        double zx = 0, zy = 0;
+        double mag = 0.0;
+
+        int iter = 0;
+        for (; iter < iterations; iter++) {
+            double zx2 = zx * zx;
+            double zy2 = zy * zy;
+            if (zx2 + zy2 > 4.0) {
+                mag = zx2 + zy2;
+                break;
+            }
+
+            zy = 2.0 * zx * zy + cy;
+            zx = zx2 - zy2 + cx[i];
+        }
+        out_iters[i] = iter;
+        out_z[2 * i] = zx;
+        out_z[2 * i + 1] = zy;
+        out_mag[i] = mag;
+    }
+}
+
+#ifdef XFRACTAL_X86
+
+// lanes that escaped stay masked off in alive and stop counting. the group
+// ends once every lane escaped, so only z of lanes that ran to the limit is
+// meaningful. |z|^2 of a lane is blended into mag on the iteration it
+// escapes. cx has to be readable up to a multiple of
+// SIMD_MAX_LANES past count
+
+__attribute__((target("sse2"))) static void _mandelbrot_row_sse2(
+    int iterations, const double* cx, double cy, int count, int* out_iters,
+    double* out_z, double* out_mag) {
+    constexpr int LANES = 2;
+
+    const __m128d two = _mm_set1_pd(2.0);
+    const __m128d four = _mm_set1_pd(4.0);
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d _cy = _mm_set1_pd(cy);
+
+    for (int i = 0; i < count; i += LANES) {
+        __m128d _cx = _mm_loadu_pd(cx + i);
+
+        __m128d zx = _mm_setzero_pd();
+        __m128d zy = _mm_setzero_pd();
+        __m128d iters = _mm_setzero_pd();
+        __m128d mag = _mm_setzero_pd();
+        __m128d alive = _mm_castsi128_pd(_mm_set1_epi32(-1));
+
+        for (int iter = 0; iter < iterations; iter++) {
+            __m128d zx2 = _mm_mul_pd(zx, zx);
+            __m128d zy2 = _mm_mul_pd(zy, zy);
+
+            __m128d mag2 = _mm_add_pd(zx2, zy2);
+            __m128d inside = _mm_cmple_pd(mag2, four);
+            if constexpr (SMOOTH_ITERATIONS) {
+                // no blendv before sse4.1
+                __m128d escaped = _mm_andnot_pd(inside, alive);
+                mag = _mm_or_pd(_mm_and_pd(escaped, mag2),
+                                _mm_andnot_pd(escaped, mag));
+            }
+            alive = _mm_and_pd(alive, inside);
+            if (_mm_movemask_pd(alive) == 0) {
+                break;
+            }
+            iters = _mm_add_pd(iters, _mm_and_pd(alive, one));
+
+            zy = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, zx), zy), _cy);
+            zx = _mm_add_pd(_mm_sub_pd(zx2, zy2), _cx);
+        }
+
+        double lane_iters[LANES], lane_zx[LANES], lane_zy[LANES];
+        double lane_mag[LANES];
+        _mm_storeu_pd(lane_iters, iters);
+        _mm_storeu_pd(lane_zx, zx);
+        _mm_storeu_pd(lane_zy, zy);
+        _mm_storeu_pd(lane_mag, mag);
+        for (int l = 0; l < LANES && i + l < count; l++) {
+            out_iters[i + l] = (int)lane_iters[l];
+            out_z[2 * (i + l)] = lane_zx[l];
+            out_z[2 * (i + l) + 1] = lane_zy[l];
+            out_mag[i + l] = lane_mag[l];
+        }
+    }
+}
+
+__attribute__((target("avx2"))) static void _mandelbrot_row_avx2(
+    int iterations, const double* cx, double cy, int count, int* out_iters,
+    double* out_z, double* out_mag) {
+    constexpr int LANES = 4;
+
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d four = _mm256_set1_pd(4.0);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d _cy = _mm256_set1_pd(cy);
+
+    for (int i = 0; i < count; i += LANES) {
+        __m256d _cx = _mm256_loadu_pd(cx + i);
+
+        __m256d zx = _mm256_setzero_pd();
+        __m256d zy = _mm256_setzero_pd();
+        __m256d iters = _mm256_setzero_pd();
+        __m256d mag = _mm256_setzero_pd();
+        __m256d alive = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+
+        for (int iter = 0; iter < iterations; iter++) {
+            __m256d zx2 = _mm256_mul_pd(zx, zx);
+            __m256d zy2 = _mm256_mul_pd(zy, zy);
+
+            __m256d mag2 = _mm256_add_pd(zx2, zy2);
+            __m256d inside = _mm256_cmp_pd(mag2, four, _CMP_LE_OQ);
+            if constexpr (SMOOTH_ITERATIONS) {
+                mag = _mm256_blendv_pd(mag, mag2,
+                                       _mm256_andnot_pd(inside, alive));
+            }
+            alive = _mm256_and_pd(alive, inside);
+            if (_mm256_movemask_pd(alive) == 0) {
+                break;
+            }
+            iters = _mm256_add_pd(iters, _mm256_and_pd(alive, one));
+
+            zy = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two, zx), zy), _cy);
+            zx = _mm256_add_pd(_mm256_sub_pd(zx2, zy2), _cx);
+        }
+
+        double lane_iters[LANES], lane_zx[LANES], lane_zy[LANES];
+        double lane_mag[LANES];
+        _mm256_storeu_pd(lane_iters, iters);
+        _mm256_storeu_pd(lane_zx, zx);
+        _mm256_storeu_pd(lane_zy, zy);
+        _mm256_storeu_pd(lane_mag, mag);
+        for (int l = 0; l < LANES && i + l < count; l++) {
+            out_iters[i + l] = (int)lane_iters[l];
+            out_z[2 * (i + l)] = lane_zx[l];
+            out_z[2 * (i + l) + 1] = lane_zy[l];
+            out_mag[i + l] = lane_mag[l];
+        }
+    }
+}
+
+__attribute__((target("avx512f"))) static void _mandelbrot_row_avx512(
+    int iterations, const double* cx, double cy, int count, int* out_iters,
+    double* out_z, double* out_mag) {
+    constexpr int LANES = 8;
+
+    const __m512d two = _mm512_set1_pd(2.0);
+    const __m512d four = _mm512_set1_pd(4.0);
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d _cy = _mm512_set1_pd(cy);
+
+    for (int i = 0; i < count; i += LANES) {
+        __m512d _cx = _mm512_loadu_pd(cx + i);
+
+        __m512d zx = _mm512_setzero_pd();
+        __m512d zy = _mm512_setzero_pd();
+        __m512d iters = _mm512_setzero_pd();
+        __m512d mag = _mm512_setzero_pd();
+        __mmask8 alive = 0xff;
+
+        for (int iter = 0; iter < iterations; iter++) {
+            __m512d zx2 = _mm512_mul_pd(zx, zx);
+            __m512d zy2 = _mm512_mul_pd(zy, zy);
+
+            __m512d mag2 = _mm512_add_pd(zx2, zy2);
+            __mmask8 inside =
+                _mm512_mask_cmp_pd_mask(alive, mag2, four, _CMP_LE_OQ);
+            if constexpr (SMOOTH_ITERATIONS) {
+                mag = _mm512_mask_mov_pd(mag, alive & ~inside, mag2);
+            }
+            alive = inside;
+            if (alive == 0) {
+                break;
+            }
+            iters = _mm512_mask_add_pd(iters, alive, iters, one);
+
+            zy = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(two, zx), zy), _cy);
+            zx = _mm512_add_pd(_mm512_sub_pd(zx2, zy2), _cx);
+        }
+
+        double lane_iters[LANES], lane_zx[LANES], lane_zy[LANES];
+        double lane_mag[LANES];
+        _mm512_storeu_pd(lane_iters, iters);
+        _mm512_storeu_pd(lane_zx, zx);
+        _mm512_storeu_pd(lane_zy, zy);
+        _mm512_storeu_pd(lane_mag, mag);
+        for (int l = 0; l < LANES && i + l < count; l++) {
+            out_iters[i + l] = (int)lane_iters[l];
+            out_z[2 * (i + l)] = lane_zx[l];
+            out_z[2 * (i + l) + 1] = lane_zy[l];
+            out_mag[i + l] = lane_mag[l];
+        }
+    }
+}
+
+#endif
+
+struct SIMDDispatch {
+    SIMDRowKernel kernel;
+    const char* name;
+};
+
+static SIMDDispatch _select_simd_kernel() {
+#ifdef XFRACTAL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return {_mandelbrot_row_avx512, "avx512"};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return {_mandelbrot_row_avx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return {_mandelbrot_row_sse2, "sse2"};
+    }
+#endif
+    return {_mandelbrot_row_scalar, "scalar"};
+}
+
+static const SIMDDispatch simd_dispatch = _select_simd_kernel();
+
+const char* _simd_kernel_name() { return simd_dispatch.name; }
+
+void _simd_section_renderer(int iterations, double& x_min, double& y_min,
+                            int width, int height, int start_x, int end_x,
+                            int start_y, int end_y, double& dx, double& dy,
+                            const RenderPass& pass, IterationBuffer& out) {
+    if (end_x <= start_x) return;
+
+    // lanes past the end of the row repeat the last pixel
+    int max_count = (end_x - start_x + pass.step - 1) / pass.step;
+    int padded =
+        (max_count + SIMD_MAX_LANES - 1) / SIMD_MAX_LANES * SIMD_MAX_LANES;
+    std::vector<double> cx(padded);
+    std::vector<int> iters(padded);
+    std::vector<double> z(2 * padded);
+    std::vector<double> mag(padded);
+    // pixel of every lane
+    std::vector<int> xs(max_count);
+    double t0, t1;
+    ResumeList resume;
+    resume.stride = 2 * DoubleMathFuncs::packed_size();
+
+    for (int y = pass.first_row(start_y); y < end_y; y += pass.step) {
+        // the pixels of a row depend on the pass, so cx is set up per row
+        int first_x, stride;
+        pass.row(y, start_x, first_x, stride);
+        if (first_x >= end_x) continue;
+
+        // same pixel -> fractal mapping as _mandelbrot_section_renderer
+        double cy = (height - y) * dy + y_min;
+
+        // pixels in the main bulbs are inside without iterating, only the
+        // others go into the lanes
+        int count = 0;
+        for (int x = first_x; x < end_x; x += stride) {
+            double px = (double)x * dx + x_min;
+            if constexpr (INTERIOR_DETECTION) {
+                if (_in_main_bulbs<double, double_math_funcs>(px, cy, t0,
+                                                              t1)) {
+                    out.set_block(x, y, pass.step, iterations, 0.0f,
+                                  pass.block_end(end_x),
+                                  pass.block_end(end_y));
+                    continue;
+                }
+            }
+            xs[count] = x;
+            cx[count] = px;
+            count++;
+        }
+        if (count == 0) continue;
+        for (int i = count; i < padded; i++) cx[i] = cx[count - 1];
+
+        simd_dispatch.kernel(iterations, cx.data(), cy, count, iters.data(),
+                             z.data(), mag.data());
+        if constexpr (RENDER_TRACE) {
+            for (int i = 0; i < count; i++) trace_iterations += iters[i];
+        }
+
+        for (int i = 0; i < count; i++) {
+            int x = xs[i];
+            out.set_block(x, y, pass.step, iters[i], _smooth_fraction(mag[i]),
+                          pass.block_end(end_x), pass.block_end(end_y));
+
+            // no cycle detection here, the rest at the limit is kept
+            if (RESUMABLE_ITERATION && iters[i] == iterations) {
+                unsigned char* packed = resume.add(y * width + x);
+                DoubleMathFuncs::pack(packed, z[2 * i]);
+                DoubleMathFuncs::pack(packed + sizeof(double), z[2 * i + 1]);
+            }
+        }
+    }
+    out.add_resume(resume);
+}
@@ -0,0 +1,218 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+#include "math.hpp"
+
+// worker running on this thread, set for the life of the worker
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local int current_worker = -1;
+// spawned by the piece of a section running on this thread
+static thread_local std::vector<ComputeSection> current_spawned;
+
+ThreadPool::ThreadPool(int n_threads) { set_threads(n_threads); }
+
+ThreadPool::~ThreadPool() { _stop(); }
+
+void ThreadPool::set_threads(int n_threads) {
+    if (n_threads <= 0) {
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (n_threads == size()) return;
+
+    std::lock_guard<std::mutex> run_lock(run_mutex);
+    _stop();
+    _start(n_threads);
+}
+
+void ThreadPool::_start(int n_threads) {
+    // every worker has to exist before the first one starts stealing
+    for (int i = 0; i < n_threads; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (int i = 0; i < n_threads; i++) {
+        workers[i]->thread = std::thread([this, i] { _worker_loop(i); });
+    }
+}
+
+void ThreadPool::_stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+
+    for (std::unique_ptr<Worker>& worker : workers) {
+        worker->thread.join();
+    }
+    workers.clear();
+    stop = false;
+}
+
+void ThreadPool::run(const std::vector<ComputeSection>& sections,
+                     SectionFunc fn, int _split_rows) {
+    if (sections.empty()) return;
+
+    std::lock_guard<std::mutex> run_lock(run_mutex);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        func = std::move(fn);
+        split_rows = _split_rows;
+        prec = MPFRMathFuncs::prec;
+
+        // deal the sections out round robin, stealing evens out the rest
+        for (size_t i = 0; i < sections.size(); i++) {
+            Worker& worker = *workers[i % workers.size()];
+            std::lock_guard<std::mutex> worker_lock(worker.mutex);
+            worker.sections.push_back(sections[i]);
+        }
+        pending = sections.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending.load() == 0; });
+}
+
+void ThreadPool::parallel_chunks(int n, int chunk_size,
+                                 const std::function<void(int, int)>& fn) {
+    std::vector<ComputeSection> chunks;
+    for (int begin = 0; begin < n; begin += chunk_size) {
+        chunks.push_back({begin, std::min(begin + chunk_size, n), 0, 1});
+    }
+
+    run(chunks, [&fn](const ComputeSection& chunk) {
+        fn(chunk.start_x, chunk.end_x);
+    });
+}
+
+ThreadPool* ThreadPool::current() { return current_pool; }
+
+const std::vector<ComputeSection>& ThreadPool::spawned() {
+    return current_spawned;
+}
+
+void ThreadPool::spawn(const ComputeSection& section) {
+    current_spawned.push_back(section);
+
+    // counted before the calling section is done, the run cannot end first
+    pending.fetch_add(1);
+    {
+        Worker& worker = *workers[current_worker];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.sections.push_back(section);
+    }
+    _notify_more();
+}
+
+void ThreadPool::_notify_more() {
+    // a worker between its last look and the wait is past it once the lock
+    // is free, so it cannot miss the notify
+    { std::lock_guard<std::mutex> lock(mutex); }
+    more.notify_one();
+}
+
+void ThreadPool::_worker_loop(int index) {
+    current_pool = this;
+    current_worker = index;
+    uint64_t seen = 0;
+
+    while (1) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stop || generation != seen; });
+            if (stop) return;
+            seen = generation;
+            MPFRMathFuncs::prec = prec;
+        }
+
+        ComputeSection section;
+        while (pending.load() > 0) {
+            if (_take(index, section)) {
+                _execute(index, section);
+                continue;
+            }
+
+            // nothing left to take, wait for a running section to split
+            idle.fetch_add(1);
+            bool found = false;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                more.wait(lock, [&] {
+                    return pending.load() == 0 ||
+                           (found = _take(index, section));
+                });
+            }
+            idle.fetch_sub(1);
+
+            if (found) _execute(index, section);
+        }
+    }
+}
+
+bool ThreadPool::_take(int index, ComputeSection& out) {
+    // own sections newest first
+    {
+        Worker& worker = *workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.sections.empty()) {
+            out = worker.sections.back();
+            worker.sections.pop_back();
+            return true;
+        }
+    }
+
+    // steal the oldest, usually largest, section of another worker
+    int n = workers.size();
+    for (int i = 1; i < n; i++) {
+        Worker& victim = *workers[(index + i) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.sections.empty()) {
+            out = victim.sections.front();
+            victim.sections.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::_execute(int index, ComputeSection section) {
+    if (split_rows <= 0) {
+        current_spawned.clear();
+        func(section);
+    } else {
+        while (section.start_y < section.end_y) {
+            int rows = section.end_y - section.start_y;
+
+            // hand the second half of what is left to an idle worker
+            if (idle.load(std::memory_order_relaxed) > 0 &&
+                rows >= 2 * split_rows) {
+                int mid = section.start_y + rows / 2;
+
+                pending.fetch_add(1);
+                {
+                    Worker& worker = *workers[index];
+                    std::lock_guard<std::mutex> lock(worker.mutex);
+                    worker.sections.push_back(
+                        {section.start_x, section.end_x, mid, section.end_y});
+                }
+                section.end_y = mid;
+                _notify_more();
+            }
+
+            int end = std::min(section.start_y + split_rows, section.end_y);
+            current_spawned.clear();
+            func({section.start_x, section.end_x, section.start_y, end});
+            section.start_y = end;
+        }
+    }
+
+    if (pending.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.notify_all();
+        // the idle workers go back to waiting for the next run
+        more.notify_all();
+    }
+}
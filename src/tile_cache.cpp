@@ -0,0 +1,114 @@
+#include "tile_cache.hpp"
+
+#include <algorithm>
+#include <functional>
+
+size_t TileKeyHash::operator()(const TileKey& key) const {
+    size_t h = std::hash<std::string>()(key.x);
+    auto mix = [&h](size_t v) { h ^= v + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2); };
+    mix(std::hash<std::string>()(key.y));
+    mix(std::hash<int>()(key.zoom));
+    mix(std::hash<int>()(key.iterations));
+    mix(std::hash<int>()(key.engine));
+    return h;
+}
+
+size_t Tile::bytes() const {
+    return sizeof(Tile) + iters.size() * sizeof(uint32_t) +
+           smooth.size() * sizeof(float);
+}
+
+std::shared_ptr<const Tile> Tile::cut(const IterationBuffer& buffer, int x,
+                                      int y) {
+    auto tile = std::make_shared<Tile>();
+    tile->iters.resize(TILE_SIZE * TILE_SIZE);
+    if (!buffer.smooth.empty()) tile->smooth.resize(TILE_SIZE * TILE_SIZE);
+
+    for (int row = 0; row < TILE_SIZE; row++) {
+        size_t src = (size_t)(y + row) * buffer.width + x;
+        std::copy_n(buffer.iters.begin() + src, TILE_SIZE,
+                    tile->iters.begin() + row * TILE_SIZE);
+        if (!tile->smooth.empty()) {
+            std::copy_n(buffer.smooth.begin() + src, TILE_SIZE,
+                        tile->smooth.begin() + row * TILE_SIZE);
+        }
+    }
+    return tile;
+}
+
+void Tile::paste(IterationBuffer& buffer, int x, int y) const {
+    for (int row = 0; row < TILE_SIZE; row++) {
+        size_t dst = (size_t)(y + row) * buffer.width + x;
+        std::copy_n(iters.begin() + row * TILE_SIZE, TILE_SIZE,
+                    buffer.iters.begin() + dst);
+
+        if (buffer.smooth.empty()) continue;
+        // tiles from renders without smooth fractions paste as 0
+        if (smooth.empty()) {
+            std::fill_n(buffer.smooth.begin() + dst, TILE_SIZE, 0.0f);
+        } else {
+            std::copy_n(smooth.begin() + row * TILE_SIZE, TILE_SIZE,
+                        buffer.smooth.begin() + dst);
+        }
+    }
+}
+
+std::shared_ptr<const Tile> TileCache::find(const TileKey& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(key);
+    if (it == index.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second;
+}
+
+bool TileCache::contains(const TileKey& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return index.count(key) != 0;
+}
+
+void TileCache::insert(const TileKey& key, std::shared_ptr<const Tile> tile) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(key);
+    if (it != index.end()) {
+        bytes -= it->second->second->bytes();
+        lru.erase(it->second);
+        index.erase(it);
+    }
+
+    bytes += tile->bytes();
+    lru.emplace_front(key, std::move(tile));
+    index[key] = lru.begin();
+    _evict();
+}
+
+void TileCache::set_budget(size_t _budget) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = _budget;
+    _evict();
+}
+
+void TileCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    lru.clear();
+    index.clear();
+    bytes = 0;
+}
+
+TileCacheStats TileCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {hits, misses, lru.size(), bytes};
+}
+
+void TileCache::_evict() {
+    while (bytes > budget && !lru.empty()) {
+        bytes -= lru.back().second->bytes();
+        index.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
@@ -21,25 +21,72 @@ void Window::key_callback(GLFWwindow* window, int key, int scancode, int action,
         if (key == GLFW_KEY_W || key == GLFW_KEY_S) {
             double factor;
             if (key == GLFW_KEY_W) {
-                factor = 1.5;
+                factor = ZOOM_STEP;
             } else if (key == GLFW_KEY_S) {
-                factor = 1. / 1.5;
+                factor = 1. / ZOOM_STEP;
             }
             self->renderer.bound_zoom(factor);
             self->update_bound_preview_rect();
+            self->renderer.speculate();
         }
 
         else if (key == GLFW_KEY_ENTER) {
-            std::thread renderer_thread([self] {
-                self->renderer.render_mandelbrot(
-                    1, std::thread::hardware_concurrency());
-            });
-            renderer_thread.detach();
+            self->renderer.render_async(PROGRESSIVE_START_STEP,
+                                        std::thread::hardware_concurrency());
         }
 
         else if (key == GLFW_KEY_1) {
             self->renderer.iterations += 64;
         }
+
+        else if (key == GLFW_KEY_M) {
+            // cycle through the implemented math types
+            constexpr MathType types[] = {
+                MathType::DOUBLE,       MathType::DOUBLE_DOUBLE,
+                MathType::FIXED_POINT,  MathType::MPFR,
+                MathType::PERTURBATION, MathType::BLA};
+            constexpr int n_types = sizeof(types) / sizeof(types[0]);
+
+            int next = 0;
+            for (int i = 0; i < n_types; i++) {
+                if (types[i] == self->renderer.type) {
+                    next = (i + 1) % n_types;
+                }
+            }
+            self->renderer.auto_math_type = false;
+            self->renderer.set_math_type(types[next]);
+            std::cout << "math type: " << math_type_name(types[next])
+                      << std::endl;
+        }
+
+        else if (key == GLFW_KEY_A) {
+            self->renderer.auto_math_type = true;
+            self->renderer.update_precision();
+            std::cout << "math type: auto" << std::endl;
+        }
+
+        else if (key == GLFW_KEY_2) {
+            self->renderer.series_approximation =
+                !self->renderer.series_approximation;
+            std::cout << "series approximation: "
+                      << (self->renderer.series_approximation ? "on" : "off")
+                      << std::endl;
+        }
+
+        else if (key == GLFW_KEY_3) {
+            self->renderer.subdivision = !self->renderer.subdivision;
+            std::cout << "subdivision: "
+                      << (self->renderer.subdivision ? "on" : "off")
+                      << std::endl;
+        }
+        else if (key == GLFW_KEY_P) {
+            // cycle through the palettes, recolors without rendering
+            int n_palettes = (int)PaletteMode::HISTOGRAM + 1;
+            PaletteMode next = (PaletteMode)(
+                ((int)self->renderer.palette.load() + 1) % n_palettes);
+            self->renderer.set_palette(next);
+            std::cout << "palette: " << palette_mode_name(next) << std::endl;
+        }
     }
 }
 
@@ -52,7 +99,14 @@ void Window::framebuffer_size_callback(GLFWwindow* window, int width,
 }
 
 void Window::mouse_button_callback(GLFWwindow* window, int button, int action,
-                                   int mods) {}
+                                   int mods) {
+    Window* self = static_cast<Window*>(glfwGetWindowUserPointer(window));
+
+    // the view stops moving, pre-render around where it ended up
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE) {
+        self->renderer.speculate();
+    }
+}
 
 std::string Window::loadFile(const std::string& path) {
     std::ifstream ifs(path, std::ios::in | std::ios::binary);
@@ -291,7 +345,6 @@ void Window::init(int _width, int _height) {
 
     renderer.set_window_size_i(width, height);
     renderer.set_fractal_bounds_d(-2.0, 1.0, 0.0, 2.0);
-    renderer.set_math_type(MathType::MPFR);
     renderer.resize_pixels(width, height);
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -0,0 +1,366 @@
+// headless zoom sequence: renders keyframes from the deepest zoom outwards
+// and resamples the frames in between from the two keyframes around them.
+// frames are written by a second thread while the next keyframe renders
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_io.hpp"
+#include "palette.hpp"
+#include "render_config.hpp"
+#include "renderer.hpp"
+
+struct ZoomOptions {
+    std::string center_x = "-0.743643887037158704752191506114774";
+    std::string center_y = "0.131825904205311970493132056385139";
+    std::string start_zoom = "1";
+    std::string zoom = "1e12";
+    // 0 for one keyframe per doubling of the zoom
+    int keyframes = 0;
+    // frames from one keyframe to the next, the keyframe included
+    int frames_per_key = 16;
+    int width = 640;
+    int height = 360;
+    int iterations = 4096;
+    std::string engine = "auto";
+    int threads = 0;
+    PaletteMode palette = PaletteMode::GRADIENT;
+    // printf pattern of the frame number
+    std::string output = "frame_%05d.png";
+};
+
+// frames from keyframe key, zoomed in from outer to inner. inner is empty for
+// the last keyframe
+struct ZoomSegment {
+    int key;
+    std::shared_ptr<const std::vector<unsigned char>> outer, inner;
+};
+
+static void _usage(const char* name) {
+    std::cerr
+        << "usage: " << name << " [options]\n"
+        << "  --center-x STR        real part of the zoom target\n"
+        << "  --center-y STR        imaginary part of the zoom target\n"
+        << "  --start-zoom STR      zoom of the first frame (1)\n"
+        << "  --zoom STR            zoom of the last frame (1e12)\n"
+        << "  --keyframes N         rendered frames, 0 for one per doubling\n"
+        << "                        of the zoom (0)\n"
+        << "  --frames-per-key N    frames from one keyframe to the next (16)\n"
+        << "  --size WxH            frame size, both even (640x360)\n"
+        << "  --iterations N        iteration limit (4096)\n"
+        << "  --engine NAME         auto, double, double-double, fixed-point,\n"
+        << "                        mpfr, perturbation or bla (auto)\n"
+        << "  --threads N           render threads, 0 for all cores (0)\n"
+        << "  --palette NAME        grey or gradient (gradient)\n"
+        << "  --output PATTERN      printf pattern of the frame number, .png\n"
+        << "                        or .ppm (frame_%05d.png)\n";
+}
+
+static bool _parse_engine(const std::string& name, MathType& type) {
+    constexpr MathType types[] = {
+        MathType::DOUBLE,      MathType::DOUBLE_DOUBLE, MathType::FIXED_POINT,
+        MathType::MPFR,        MathType::PERTURBATION,  MathType::BLA};
+    for (MathType t : types) {
+        if (name == math_type_name(t)) {
+            type = t;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool _parse_args(int argc, char** argv, ZoomOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+
+        if (arg == "--center-x") {
+            options.center_x = value;
+        } else if (arg == "--center-y") {
+            options.center_y = value;
+        } else if (arg == "--start-zoom") {
+            options.start_zoom = value;
+        } else if (arg == "--zoom") {
+            options.zoom = value;
+        } else if (arg == "--keyframes") {
+            options.keyframes = std::atoi(value.c_str());
+        } else if (arg == "--frames-per-key") {
+            options.frames_per_key = std::atoi(value.c_str());
+        } else if (arg == "--size") {
+            if (std::sscanf(value.c_str(), "%dx%d", &options.width,
+                            &options.height) != 2) {
+                return false;
+            }
+        } else if (arg == "--iterations") {
+            options.iterations = std::atoi(value.c_str());
+        } else if (arg == "--engine") {
+            options.engine = value;
+        } else if (arg == "--threads") {
+            options.threads = std::atoi(value.c_str());
+        } else if (arg == "--palette") {
+            // the histogram palette would flicker from keyframe to keyframe
+            if (value == palette_mode_name(PaletteMode::GREY)) {
+                options.palette = PaletteMode::GREY;
+            } else if (value == palette_mode_name(PaletteMode::GRADIENT)) {
+                options.palette = PaletteMode::GRADIENT;
+            } else {
+                return false;
+            }
+        } else if (arg == "--output") {
+            options.output = value;
+        } else {
+            return false;
+        }
+    }
+
+    // the view center has to be a pixel, the reference orbit is computed
+    // there and reused by every keyframe
+    return options.width > 0 && options.height > 0 &&
+           options.width % 2 == 0 && options.height % 2 == 0 &&
+           options.iterations > 0 && options.keyframes >= 0 &&
+           options.keyframes != 1 && options.frames_per_key > 0 &&
+           options.output.find('%') != std::string::npos;
+}
+
+// log2 of a positive decimal string, which may be far outside the double range
+static bool _log2(const std::string& value, double& out) {
+    mpfr_t n;
+    mpfr_init2(n, MPFR_MIN_PREC);
+    bool parsed = mpfr_set_str(n, value.c_str(), 10, MPFR_RNDN) == 0 &&
+                  mpfr_sgn(n) > 0;
+    if (parsed) {
+        long exp;
+        double mantissa = mpfr_get_d_2exp(&exp, n, MPFR_RNDN);
+        out = exp + std::log2(mantissa);
+    }
+    mpfr_clear(n);
+    return parsed;
+}
+
+// bilinear sample of rgb at x, y, clamped to the image
+static void _sample(const std::vector<unsigned char>& rgb, int width,
+                    int height, double x, double y, unsigned char* out) {
+    x = std::clamp(x, 0.0, width - 1.0);
+    y = std::clamp(y, 0.0, height - 1.0);
+    int x0 = std::min((int)x, width - 2), y0 = std::min((int)y, height - 2);
+    double fx = x - x0, fy = y - y0;
+
+    const unsigned char* p = rgb.data() + ((size_t)y0 * width + x0) * 3;
+    const unsigned char* q = p + (size_t)width * 3;
+    for (int c = 0; c < 3; c++) {
+        double top = p[c] + (p[c + 3] - p[c]) * fx;
+        double bottom = q[c] + (q[c + 3] - q[c]) * fx;
+        out[c] = (unsigned char)std::lround(top + (bottom - top) * fy);
+    }
+}
+
+// frame zoomed in by scale from outer, where inner is outer zoomed in by
+// key_factor. both are centered on the same point, the part inner covers is
+// taken from it
+static void _resample(const ZoomSegment& segment, double scale,
+                      double key_factor, int width, int height,
+                      std::vector<unsigned char>& frame) {
+    frame.resize((size_t)width * height * 3);
+    double cx = width / 2, cy = height / 2;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned char* out = frame.data() + ((size_t)y * width + x) * 3;
+
+            if (segment.inner) {
+                double ix = cx + (x - cx) * key_factor / scale;
+                double iy = cy + (y - cy) * key_factor / scale;
+                if (ix >= 0 && ix <= width - 1 && iy >= 0 &&
+                    iy <= height - 1) {
+                    _sample(*segment.inner, width, height, ix, iy, out);
+                    continue;
+                }
+            }
+            _sample(*segment.outer, width, height, cx + (x - cx) / scale,
+                    cy + (y - cy) / scale, out);
+        }
+    }
+}
+
+// writes the frames of queued segments until the queue is closed
+struct FrameWriter {
+    const ZoomOptions& options;
+    double key_factor;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<ZoomSegment> segments;
+    bool closed = false;
+    bool failed = false;
+    int written = 0;
+
+    std::thread thread;
+
+    FrameWriter(const ZoomOptions& _options, double _key_factor)
+        : options(_options), key_factor(_key_factor) {
+        thread = std::thread([this] { _loop(); });
+    }
+
+    void push(ZoomSegment segment) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            segments.push_back(std::move(segment));
+        }
+        wake.notify_one();
+    }
+
+    // waits for the queued frames, false if one could not be written
+    bool finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        wake.notify_one();
+        thread.join();
+        return !failed;
+    }
+
+    void _loop() {
+        std::vector<unsigned char> frame;
+        while (1) {
+            ZoomSegment segment;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return closed || !segments.empty(); });
+                if (segments.empty()) return;
+                segment = std::move(segments.front());
+                segments.pop_front();
+            }
+
+            // the last keyframe is a segment of one frame
+            int n = segment.inner ? options.frames_per_key : 1;
+            for (int i = 0; i < n; i++) {
+                int index = segment.key * options.frames_per_key + i;
+                double scale = std::pow(key_factor,
+                                        (double)i / options.frames_per_key);
+                const std::vector<unsigned char>* pixels = segment.outer.get();
+                if (i > 0) {
+                    _resample(segment, scale, key_factor, options.width,
+                              options.height, frame);
+                    pixels = &frame;
+                }
+
+                char path[4096];
+                std::snprintf(path, sizeof(path), options.output.c_str(),
+                              index);
+                if (!write_image(path, *pixels, options.width,
+                                 options.height)) {
+                    std::cerr << "cannot write " << path << std::endl;
+                    failed = true;
+                }
+                written++;
+            }
+        }
+    }
+};
+
+int main(int argc, char** argv) {
+    ZoomOptions options;
+    if (!_parse_args(argc, argv, options)) {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    double log2_start, log2_end;
+    if (!_log2(options.start_zoom, log2_start) ||
+        !_log2(options.zoom, log2_end) || log2_end <= log2_start) {
+        std::cerr << "the zoom has to be larger than the start zoom"
+                  << std::endl;
+        return 1;
+    }
+    int keyframes = options.keyframes > 0
+                        ? options.keyframes
+                        : (int)std::ceil(log2_end - log2_start) + 1;
+    keyframes = std::max(keyframes, 2);
+    // zoom from one keyframe to the next
+    double key_factor =
+        std::exp2((log2_end - log2_start) / (keyframes - 1));
+
+    auto start = std::chrono::steady_clock::now();
+
+    Renderer renderer;
+    // every keyframe is a new view, nothing to keep tiles for
+    renderer.tiling = false;
+    renderer.speculation = false;
+    renderer.iterations = options.iterations;
+    renderer.palette = options.palette;
+
+    renderer.init_bounds();
+    renderer.set_window_size_i(options.width, options.height);
+    renderer.set_fractal_bounds_d(-2.0, 1.0, -1.0, 1.0);
+    // deepest first: the view starts at the full precision of the target and
+    // only loses bits while zooming out, and the reference orbit of the
+    // deepest keyframe serves all others
+    if (!renderer.set_view(options.center_x, options.center_y,
+                           options.zoom)) {
+        std::cerr << "cannot parse the center or zoom" << std::endl;
+        return 1;
+    }
+
+    if (options.engine != "auto") {
+        MathType type;
+        if (!_parse_engine(options.engine, type)) {
+            std::cerr << "unknown engine " << options.engine << std::endl;
+            return 1;
+        }
+        renderer.auto_math_type = false;
+        renderer.set_math_type(type);
+    }
+
+    int n_threads = options.threads > 0
+                        ? options.threads
+                        : (int)std::thread::hardware_concurrency();
+
+    std::cout << "zoom: " << keyframes << " keyframes " << key_factor
+              << "x apart, "
+              << (keyframes - 1) * options.frames_per_key + 1 << " frames"
+              << std::endl;
+
+    FrameWriter writer(options, key_factor);
+    std::shared_ptr<const std::vector<unsigned char>> inner;
+    double render_ms = 0.0;
+
+    for (int key = keyframes - 1; key >= 0; key--) {
+        // only mpfr_bounds is zoomed, the bounds of the cheaper engines auto
+        // hands the outer keyframes to are derived from it on every step
+        if (key < keyframes - 1) {
+            renderer.bound_zoom(1.0 / key_factor);
+        }
+
+        std::shared_ptr<RenderJob> job = renderer.render_async(1, n_threads);
+        job->wait();
+        render_ms += job->took_ms;
+        std::cout << "zoom: keyframe " << key << " " << math_type_name(job->type)
+                  << " " << job->took_ms << " ms" << std::endl;
+
+        auto outer =
+            std::make_shared<const std::vector<unsigned char>>(renderer.pixels);
+        writer.push({key, outer, inner});
+        inner = outer;
+    }
+
+    bool written = writer.finish();
+    double total_ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    std::cout << "zoom: " << writer.written << " frames in " << total_ms
+              << " ms, " << render_ms << " ms rendering keyframes" << std::endl;
+    return written ? 0 : 1;
+}